@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -39,6 +36,10 @@
        it is 1, for the second half it is 0.  This is useful for
        generating a tone on a speaker.
 
+     - Mode 0 counts down once and then raises its output, which
+       yields a single interrupt.  Use pit_configure_oneshot()
+       for that.
+
      - Other modes are less useful.
 
    FREQUENCY is the number of periods per second, in Hz. */
@@ -81,3 +82,22 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Configures the given CHANNEL in the PIT in mode 0, "interrupt
+   on terminal count", so that its output rises once, after COUNT
+   PIT cycles, and then stays high.  On channel 0 this raises a
+   single timer interrupt.  COUNT must be between 1 and 65535. */
+void
+pit_configure_oneshot (int channel, unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (count >= 1 && count <= 65535);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
@@ -0,0 +1,241 @@
+#include "pqueue.h"
+#include "../debug.h"
+
+/* Our pairing heap is a tree whose root, if any, is the greatest
+   element.  Each element points to its leftmost child through
+   `child', and to its right sibling through `next'.  `prev'
+   points to the left sibling, or to the parent for a leftmost
+   child, so that any element can be cut out of the tree in
+   constant time.  The root's `prev' and `next' are null. */
+
+static bool before (const struct pqueue *,
+                    const struct pq_elem *, const struct pq_elem *);
+static struct pq_elem *link (struct pqueue *,
+                             struct pq_elem *, struct pq_elem *);
+static void cut (struct pq_elem *);
+static struct pq_elem *merge_pairs (struct pqueue *, struct pq_elem *);
+static void insert (struct pqueue *, struct pq_elem *);
+
+/* Initializes Q as an empty priority queue that orders its
+   elements with LESS, given auxiliary data AUX. */
+void
+pq_init (struct pqueue *q, pq_less_func *less, void *aux) 
+{
+  ASSERT (q != NULL);
+  ASSERT (less != NULL);
+
+  q->root = NULL;
+  q->size = 0;
+  q->next_seq = 0;
+  q->less = less;
+  q->aux = aux;
+}
+
+/* Inserts E into Q. */
+void
+pq_push (struct pqueue *q, struct pq_elem *e) 
+{
+  ASSERT (q != NULL);
+  ASSERT (e != NULL);
+
+  e->seq = q->next_seq++;
+  insert (q, e);
+  q->size++;
+}
+
+/* Removes the greatest element from Q and returns it.  Undefined
+   behavior if Q is empty. */
+struct pq_elem *
+pq_pop_max (struct pqueue *q) 
+{
+  struct pq_elem *max = pq_max (q);
+
+  q->root = merge_pairs (q, max->child);
+  max->child = NULL;
+  q->size--;
+  return max;
+}
+
+/* Removes E, which must be in Q, from Q. */
+void
+pq_remove (struct pqueue *q, struct pq_elem *e) 
+{
+  struct pq_elem *children;
+
+  ASSERT (q != NULL);
+  ASSERT (e != NULL);
+  ASSERT (!pq_empty (q));
+
+  if (e == q->root) 
+    {
+      pq_pop_max (q);
+      return;
+    }
+
+  cut (e);
+  children = merge_pairs (q, e->child);
+  e->child = NULL;
+  if (children != NULL)
+    q->root = link (q, q->root, children);
+  q->size--;
+}
+
+/* Restores Q's ordering after the key of E, which must be in Q,
+   has increased, so that E compares greater than or equal to
+   its old value.  Takes constant time. */
+void
+pq_increase (struct pqueue *q, struct pq_elem *e) 
+{
+  ASSERT (q != NULL);
+  ASSERT (e != NULL);
+
+  /* E still compares greater than or equal to all of its
+     descendants, so its whole subtree can move. */
+  if (e != q->root) 
+    {
+      cut (e);
+      q->root = link (q, q->root, e);
+    }
+}
+
+/* Restores Q's ordering after the key of E, which must be in Q,
+   has changed in either direction.  E keeps its place among
+   elements that compare equal to it. */
+void
+pq_update (struct pqueue *q, struct pq_elem *e) 
+{
+  unsigned seq = e->seq;
+
+  pq_remove (q, e);
+  e->seq = seq;
+  insert (q, e);
+  q->size++;
+}
+
+/* Returns the greatest element in Q.  Undefined behavior if Q is
+   empty. */
+struct pq_elem *
+pq_max (struct pqueue *q) 
+{
+  ASSERT (q != NULL);
+  ASSERT (!pq_empty (q));
+
+  return q->root;
+}
+
+/* Returns the number of elements in Q. */
+size_t
+pq_size (struct pqueue *q) 
+{
+  ASSERT (q != NULL);
+  return q->size;
+}
+
+/* Returns true if Q is empty, false otherwise. */
+bool
+pq_empty (struct pqueue *q) 
+{
+  ASSERT (q != NULL);
+  return q->root == NULL;
+}
+
+/* Returns true if A should leave Q before B: that is, if A is
+   greater than B, or equal to B but pushed earlier. */
+static bool
+before (const struct pqueue *q,
+        const struct pq_elem *a, const struct pq_elem *b) 
+{
+  if (q->less (b, a, q->aux))
+    return true;
+  else if (q->less (a, b, q->aux))
+    return false;
+  else
+    return (int) (a->seq - b->seq) < 0;
+}
+
+/* Merges the trees rooted at A and B, neither of which may have
+   siblings, by making the root that should leave Q later the
+   leftmost child of the other.  Returns the new root. */
+static struct pq_elem *
+link (struct pqueue *q, struct pq_elem *a, struct pq_elem *b) 
+{
+  if (before (q, b, a)) 
+    {
+      struct pq_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  a->prev = a->next = NULL;
+  return a;
+}
+
+/* Detaches E, which must not be the root, and its subtree from
+   the tree containing it. */
+static void
+cut (struct pq_elem *e) 
+{
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+  e->prev = e->next = NULL;
+}
+
+/* Merges the list of sibling trees that starts at FIRST into a
+   single tree and returns its root, or a null pointer if FIRST
+   is null.  Uses the standard two-pass method: link the trees in
+   pairs from left to right, then link each resulting tree into
+   the accumulated one from right to left. */
+static struct pq_elem *
+merge_pairs (struct pqueue *q, struct pq_elem *first) 
+{
+  struct pq_elem *pairs = NULL;         /* Linked pairs, rightmost first. */
+  struct pq_elem *root = NULL;
+
+  while (first != NULL) 
+    {
+      struct pq_elem *a = first;
+      struct pq_elem *b = a->next;
+
+      if (b != NULL)
+        {
+          first = b->next;
+          a->prev = a->next = b->prev = b->next = NULL;
+          a = link (q, a, b);
+        }
+      else 
+        {
+          first = NULL;
+          a->prev = NULL;
+        }
+      a->next = pairs;
+      pairs = a;
+    }
+
+  while (pairs != NULL) 
+    {
+      struct pq_elem *next = pairs->next;
+
+      pairs->next = NULL;
+      root = root != NULL ? link (q, root, pairs) : pairs;
+      pairs = next;
+    }
+  return root;
+}
+
+/* Links E, whose sequence number is already set, into Q as a
+   tree by itself. */
+static void
+insert (struct pqueue *q, struct pq_elem *e) 
+{
+  e->child = e->prev = e->next = NULL;
+  q->root = q->root != NULL ? link (q, q->root, e) : e;
+}
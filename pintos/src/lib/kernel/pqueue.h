@@ -0,0 +1,84 @@
+#ifndef __LIB_KERNEL_PQUEUE_H
+#define __LIB_KERNEL_PQUEUE_H
+
+/* Priority queue.
+
+   This is a pairing heap: a heap-ordered tree in which each
+   node keeps a pointer to its leftmost child, and the children
+   of a node are linked through their `next' members.  Pushing an
+   element, looking at the maximum, and increasing an element's
+   key take O(1) time; popping the maximum and removing an
+   arbitrary element take O(log n) amortized time.
+
+   Like a list, a priority queue does not require dynamically
+   allocated memory.  Instead, each structure that can be in a
+   priority queue embeds a struct pq_elem member, and pq_entry()
+   converts a struct pq_elem back into the structure that
+   contains it.  Refer to lib/kernel/list.h for a detailed
+   explanation of the technique.
+
+   The queue orders its elements with a caller-supplied "less
+   than" function and yields the greatest element first.
+   Elements that compare equal are yielded in the order in which
+   they were pushed.
+
+   If the key of an element in the queue changes, the queue must
+   be told by calling pq_increase() (if the element now compares
+   greater) or pq_update() (in any case) before any other
+   operation on it. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Priority queue element. */
+struct pq_elem 
+  {
+    struct pq_elem *child;      /* Leftmost child. */
+    struct pq_elem *next;       /* Next sibling to the right. */
+    struct pq_elem *prev;       /* Previous sibling, or parent if leftmost. */
+    unsigned seq;               /* Order of insertion, to break ties. */
+  };
+
+/* Converts pointer to priority queue element PQ_ELEM into a
+   pointer to the structure that PQ_ELEM is embedded inside.
+   Supply the name of the outer structure STRUCT and the member
+   name MEMBER of the priority queue element. */
+#define pq_entry(PQ_ELEM, STRUCT, MEMBER)               \
+        ((STRUCT *) ((uint8_t *) &(PQ_ELEM)->next       \
+                     - offsetof (STRUCT, MEMBER.next)))
+
+/* Compares the value of two priority queue elements A and B,
+   given auxiliary data AUX.  Returns true if A is less than B,
+   or false if A is greater than or equal to B. */
+typedef bool pq_less_func (const struct pq_elem *a,
+                           const struct pq_elem *b,
+                           void *aux);
+
+/* Priority queue. */
+struct pqueue 
+  {
+    struct pq_elem *root;       /* Greatest element, or null if empty. */
+    size_t size;                /* Number of elements. */
+    unsigned next_seq;          /* Sequence number for next push. */
+    pq_less_func *less;         /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void pq_init (struct pqueue *, pq_less_func *, void *aux);
+
+/* Insertion and removal. */
+void pq_push (struct pqueue *, struct pq_elem *);
+struct pq_elem *pq_pop_max (struct pqueue *);
+void pq_remove (struct pqueue *, struct pq_elem *);
+
+/* Key changes. */
+void pq_increase (struct pqueue *, struct pq_elem *);
+void pq_update (struct pqueue *, struct pq_elem *);
+
+/* Properties. */
+struct pq_elem *pq_max (struct pqueue *);
+size_t pq_size (struct pqueue *);
+bool pq_empty (struct pqueue *);
+
+#endif /* lib/kernel/pqueue.h */
@@ -0,0 +1,147 @@
+/* Test program for lib/kernel/pqueue.c.
+
+   Pushes shuffled values into priority queues of various sizes,
+   raises, changes, and removes some of them, and verifies that
+   the rest come out greatest first, with equal values in the
+   order in which they were pushed.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <pqueue.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Maximum number of elements in a priority queue that we will
+   test. */
+#define MAX_SIZE 64
+
+/* A priority queue element. */
+struct value 
+  {
+    struct pq_elem elem;        /* Priority queue element. */
+    int value;                  /* Item value. */
+    int order;                  /* Order pushed, among equal values. */
+    bool removed;               /* Removed by pq_remove()? */
+  };
+
+static void shuffle (struct value[], size_t);
+static bool value_less (const struct pq_elem *, const struct pq_elem *,
+                        void *);
+static void verify_pqueue (struct pqueue *, int size);
+
+/* Test the priority queue implementation. */
+void
+test (void) 
+{
+  int size;
+
+  printf ("testing various size priority queues:");
+  for (size = 0; size < MAX_SIZE; size++) 
+    {
+      int repeat;
+
+      printf (" %d", size);
+      for (repeat = 0; repeat < 10; repeat++) 
+        {
+          static struct value values[MAX_SIZE];
+          struct pqueue pq;
+          int i, removed;
+
+          /* Put values 0...SIZE/2, each twice, in random order in
+             VALUES, and push them. */
+          for (i = 0; i < size; i++)
+            values[i].value = i / 2;
+          shuffle (values, size);
+          pq_init (&pq, value_less, NULL);
+          for (i = 0; i < size; i++) 
+            {
+              values[i].order = i;
+              values[i].removed = false;
+              pq_push (&pq, &values[i].elem);
+            }
+          ASSERT (pq_size (&pq) == (size_t) size);
+
+          /* Raise some values, change others arbitrarily, and
+             remove a few. */
+          removed = 0;
+          for (i = 0; i < size; i++)
+            switch (random_ulong () % 4) 
+              {
+              case 0:
+                values[i].value += random_ulong () % 8;
+                pq_increase (&pq, &values[i].elem);
+                break;
+              case 1:
+                values[i].value = random_ulong () % size;
+                pq_update (&pq, &values[i].elem);
+                break;
+              case 2:
+                if (random_ulong () % 4 == 0) 
+                  {
+                    pq_remove (&pq, &values[i].elem);
+                    values[i].removed = true;
+                    removed++;
+                  }
+                break;
+              }
+          ASSERT (pq_size (&pq) == (size_t) (size - removed));
+
+          verify_pqueue (&pq, size - removed);
+        }
+    }
+  
+  printf (" done\n");
+  printf ("pqueue: PASS\n");
+}
+
+/* Shuffles the CNT elements in ARRAY into random order. */
+static void
+shuffle (struct value *array, size_t cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      size_t j = i + random_ulong () % (cnt - i);
+      struct value t = array[j];
+      array[j] = array[i];
+      array[i] = t;
+    }
+}
+
+/* Returns true if value A is less than value B, false
+   otherwise. */
+static bool
+value_less (const struct pq_elem *a_, const struct pq_elem *b_,
+            void *aux UNUSED) 
+{
+  const struct value *a = pq_entry (a_, struct value, elem);
+  const struct value *b = pq_entry (b_, struct value, elem);
+  
+  return a->value < b->value;
+}
+
+/* Pops all SIZE elements of PQ and verifies that they come out
+   in nonincreasing order, equal values in the order pushed. */
+static void
+verify_pqueue (struct pqueue *pq, int size) 
+{
+  struct value *prev = NULL;
+  int i;
+
+  for (i = 0; i < size; i++) 
+    {
+      struct value *v = pq_entry (pq_pop_max (pq), struct value, elem);
+
+      ASSERT (!v->removed);
+      ASSERT (prev == NULL || prev->value > v->value
+              || (prev->value == v->value && prev->order < v->order));
+      prev = v;
+    }
+  ASSERT (pq_empty (pq));
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-subtick) begin
+(alarm-subtick) 0 sleeps were too short.
+(alarm-subtick) Other thread found us blocked.
+(alarm-subtick) end
+EOF
+pass;
@@ -0,0 +1,70 @@
+/* Measures the cost of a context switch as the number of ready
+   threads grows.  For each thread count, that many threads at
+   the same priority each call thread_yield() in a loop, so every
+   yield requeues the running thread behind all of the others.
+   The total number of switches is the same in every round, so
+   if requeueing and picking the next thread take constant time
+   the reported tick counts stay roughly flat. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Total number of thread_yield() calls made in each round. */
+#define SWITCH_CNT (1 << 18)
+
+static thread_func yield_thread_func;
+
+static void
+run_round (int thread_cnt) 
+{
+  int yield_cnt = SWITCH_CNT / thread_cnt;
+  int64_t start;
+  int i;
+
+  /* Create all of the threads before any of them runs, so that
+     every yield sees THREAD_CNT ready threads. */
+  thread_set_priority (PRI_DEFAULT + 2);
+  for (i = 0; i < thread_cnt; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "%d", i);
+      thread_create (name, PRI_DEFAULT + 1, yield_thread_func,
+                     (void *) yield_cnt);
+    }
+
+  /* All the other threads now run to termination here. */
+  start = timer_ticks ();
+  thread_set_priority (PRI_DEFAULT);
+
+  msg ("%d threads: %d switches in %"PRId64" ticks.",
+       thread_cnt, yield_cnt * thread_cnt, timer_elapsed (start));
+}
+
+void
+test_priority_switch_cost (void) 
+{
+  int thread_cnt;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  for (thread_cnt = 4; thread_cnt <= 256; thread_cnt *= 4)
+    run_round (thread_cnt);
+}
+
+static void 
+yield_thread_func (void *yield_cnt_) 
+{
+  int yield_cnt = (int) yield_cnt_;
+  int i;
+
+  for (i = 0; i < yield_cnt; i++) 
+    thread_yield ();
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+
+# The expected output looks like this, where the tick counts vary
+# from run to run but should stay roughly the same from one line
+# to the next:
+#
+# (priority-switch-cost) 4 threads: 262144 switches in 30 ticks.
+# (priority-switch-cost) 16 threads: 262144 switches in 30 ticks.
+# (priority-switch-cost) 64 threads: 262144 switches in 31 ticks.
+# (priority-switch-cost) 256 threads: 262144 switches in 31 ticks.
+
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+my (@rounds) = grep (/threads: \d+ switches in \d+ ticks/, @output);
+fail "4 rounds expected but " . scalar (@rounds) . " found\n"
+  if @rounds != 4;
+
+pass;
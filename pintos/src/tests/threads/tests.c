@@ -17,6 +17,8 @@ static const struct test tests[] =
     {"alarm-priority", test_alarm_priority},
     {"alarm-zero", test_alarm_zero},
     {"alarm-negative", test_alarm_negative},
+    {"alarm-stress", test_alarm_stress},
+    {"alarm-subtick", test_alarm_subtick},
     {"priority-change", test_priority_change},
     {"priority-donate-one", test_priority_donate_one},
     {"priority-donate-multiple", test_priority_donate_multiple},
@@ -29,6 +31,7 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"priority-switch-cost", test_priority_switch_cost},
 };
 
 static const char *test_name;
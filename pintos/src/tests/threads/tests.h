@@ -11,6 +11,8 @@ extern test_func test_alarm_simultaneous;
 extern test_func test_alarm_priority;
 extern test_func test_alarm_zero;
 extern test_func test_alarm_negative;
+extern test_func test_alarm_stress;
+extern test_func test_alarm_subtick;
 extern test_func test_priority_change;
 extern test_func test_priority_donate_one;
 extern test_func test_priority_donate_multiple;
@@ -23,6 +25,7 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_priority_switch_cost;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
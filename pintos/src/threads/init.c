@@ -143,7 +143,7 @@ main (void)
   serial_init_queue ();
 
   /* tom: calibrating the timer involves counting the number
-   * of loop iterations between timer interrupts, to measure 
+   * of CPU cycles between timer interrupts, to measure 
    * the relative speed of the processor.  So interrupts need to be on */
   timer_calibrate ();
 
@@ -288,6 +288,8 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -416,6 +418,7 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer tick while the CPU is idle.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
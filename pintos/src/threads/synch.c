@@ -32,18 +32,11 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
-/* Priority comparison function for struct thread */
-static bool 
-compare_priority(const struct list_elem *a, 
-                 const struct list_elem *b, 
-                 void *aux); 
+/* Priority comparison function for semaphore waiters */
+static pq_less_func compare_priority;
 
-
-/* Priority comparison function for struct semaphore_elem */
-static bool
-compare_priority_cond (const struct list_elem *a,
-                       const struct list_elem *b,
-                       void *aux);
+/* Priority comparison function for condition variable waiters */
+static pq_less_func compare_priority_cond;
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -53,14 +46,18 @@ compare_priority_cond (const struct list_elem *a,
      decrement it.
 
    - up or "V": increment the value (and wake up one waiting
-     thread, if any). */
+     thread, if any).
+
+   Waiters are kept in a priority queue keyed on their effective
+   priority, so waking the highest-priority one does not require
+   a sort. */
 void
 sema_init (struct semaphore *sema, unsigned value) 
 {
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  pq_init (&sema->waiters, compare_priority, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -81,7 +78,17 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     { 
-      list_push_back (&sema->waiters, &thread_current ()->elem);   
+      struct thread *cur = thread_current ();
+
+      /* Record where we wait, so that a priority donation can
+         re-key us.  A thread in cond_wait() is already recorded
+         as waiting on the condition variable instead. */
+      pq_push (&sema->waiters, &cur->waitelem);
+      if (cur->wait_queue == NULL) 
+        {
+          cur->wait_queue = &sema->waiters;
+          cur->wait_elem = &cur->waitelem;
+        }
       thread_block ();
     }
   sema->value--;
@@ -133,11 +140,12 @@ sema_up (struct semaphore *sema)
    * immediately use the locked object */
 
   sema->value++;
-  if (!list_empty (&sema->waiters)) 
+  if (!pq_empty (&sema->waiters)) 
     {
-      list_sort (&sema->waiters, compare_priority, NULL);
-      struct thread *front = list_entry (list_pop_front (&sema->waiters),
-                                         struct thread, elem);
+      struct thread *front = pq_entry (pq_pop_max (&sema->waiters),
+                                       struct thread, waitelem);
+      if (front->wait_queue == &sema->waiters)
+        front->wait_queue = NULL;
       thread_unblock (front);
     }
   intr_set_level (old_level);
@@ -306,18 +314,21 @@ lock_release (struct lock *lock)
       e = list_next(e))
     {
       struct lock *next_lock = list_entry(e, struct lock, lock_elem);
-      struct list_elem *elem = list_max (&next_lock->semaphore.waiters,
-                                     compare_priority, NULL);
-      struct thread *max_thread = list_entry (elem, struct thread, elem);
-      int priority = max_thread->priority;
-      if(priority > next_priority)
+      struct pqueue *waiters = &next_lock->semaphore.waiters;
+      if (!pq_empty (waiters))
         {
-          next_priority = priority;
+          struct thread *max_thread = pq_entry (pq_max (waiters),
+                                                struct thread, waitelem);
+          int priority = max_thread->priority;
+          if(priority > next_priority)
+            {
+              next_priority = priority;
+            }
         }
      }  
 
   /* Assign the new priority to the current thread, and */
-  cur->priority = next_priority;
+  thread_change_priority (cur, next_priority);
   lock->holder = NULL;
   sema_up (&lock->semaphore);
 }
@@ -333,12 +344,12 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* One semaphore in a condition variable's wait queue. */
 struct semaphore_elem 
   {
-    struct list_elem elem;              /* List element. */
+    struct pq_elem elem;                /* Priority queue element. */
     struct semaphore semaphore;         /* This semaphore. */
-    int priority;                       /* Priority */
+    struct thread *thread;              /* Waiting thread. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -349,7 +360,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  pq_init (&cond->waiters, compare_priority_cond, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -390,17 +401,24 @@ void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
   struct semaphore_elem waiter;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  waiter.priority = thread_current ()->priority;
-  
+  /* The waiter is keyed on the thread's effective priority, which
+     may change while it waits, so record where it waits for
+     thread_change_priority() to re-key it. */
+  waiter.thread = cur;
   sema_init (&waiter.semaphore, 0);
-  list_insert_ordered (&cond->waiters, &waiter.elem, 
-                       compare_priority_cond, NULL);
+  old_level = intr_disable ();
+  pq_push (&cond->waiters, &waiter.elem);
+  cur->wait_queue = &cond->waiters;
+  cur->wait_elem = &waiter.elem;
+  intr_set_level (old_level);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
@@ -421,9 +439,19 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+  if (!pq_empty (&cond->waiters)) 
+    {
+      struct semaphore_elem *waiter;
+      enum intr_level old_level;
+
+      old_level = intr_disable ();
+      waiter = pq_entry (pq_pop_max (&cond->waiters),
+                         struct semaphore_elem, elem);
+      waiter->thread->wait_queue = NULL;
+      intr_set_level (old_level);
+
+      sema_up (&waiter->semaphore);
+    }
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -438,42 +466,35 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!pq_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
 
 /* Compares the priorities of the threads associated with two
- * list_elem structs. Returns whether the first's priority is
- * greater than that of the second */
+ * semaphore wait queue elements. Returns whether the first's
+ * priority is less than that of the second */
 static bool
-compare_priority(const struct list_elem *a,
-                 const struct list_elem *b,
-                 void *aux)
+compare_priority (const struct pq_elem *a,
+                  const struct pq_elem *b,
+                  void *aux UNUSED)
 {
-  /* Grab the threads associated with the two ready_list elements */
-  struct thread *t1 = list_entry (a, struct thread, elem);
-  struct thread *t2 = list_entry (b, struct thread, elem);
+  struct thread *t1 = pq_entry (a, struct thread, waitelem);
+  struct thread *t2 = pq_entry (b, struct thread, waitelem);
 
-  int a_priority = t1->priority;
-  int b_priority = t2->priority;
-
-  return a_priority > b_priority;
+  return t1->priority < t2->priority;
 }
 
-/* Compares the priorities of the semaphore_elems associated with
- * two list_elem structs. Returns whether the first's priority is
- * greater than that of the second */
+/* Compares the priorities of the threads waiting in the
+ * semaphore_elems associated with two condition variable wait
+ * queue elements. Returns whether the first's priority is less
+ * than that of the second */
 static bool
-compare_priority_cond (const struct list_elem *a,
-                       const struct list_elem *b,
-                       void *aux)
+compare_priority_cond (const struct pq_elem *a,
+                       const struct pq_elem *b,
+                       void *aux UNUSED)
 {
-  /* Grab the threads associated with the two ready_list elements */
-  struct semaphore_elem *s1 = list_entry (a, struct semaphore_elem, elem);
-  struct semaphore_elem *s2 = list_entry (b, struct semaphore_elem, elem);
-
-  int a_priority = s1->priority;
-  int b_priority = s2->priority;
+  struct semaphore_elem *s1 = pq_entry (a, struct semaphore_elem, elem);
+  struct semaphore_elem *s2 = pq_entry (b, struct semaphore_elem, elem);
 
-  return a_priority > b_priority;
+  return s1->thread->priority < s2->thread->priority;
 }
@@ -2,13 +2,14 @@
 #define THREADS_SYNCH_H
 
 #include <list.h>
+#include <pqueue.h>
 #include <stdbool.h>
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct pqueue waiters;      /* Waiting threads, by priority. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -34,7 +35,7 @@ bool lock_held_by_current_thread (const struct lock *);
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct pqueue waiters;      /* Waiting threads, by priority. */
   };
 
 
@@ -11,6 +11,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,9 +21,17 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of distinct priority levels. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/* Run queues of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority level, and bit P of
+   ready_mask is set exactly when ready_queues[P] is nonempty,
+   so the highest-priority ready thread is found with a single
+   bit scan rather than by keeping one long list sorted. */
+static struct list ready_queues[PRI_CNT];
+static uint64_t ready_mask;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -66,10 +75,9 @@ static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
-static bool compare_priority(const struct list_elem *a, 
-                             const struct list_elem *b, 
-                             void *aux);
-
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static int ready_queue_max_priority (void);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
@@ -104,8 +112,12 @@ thread_init (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
+  int i;
+
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -164,6 +176,18 @@ thread_tick (void)
     intr_yield_on_return ();
 }
 
+/* Accounts for a timer tick that went by while the CPU was
+   halted in tickless idle, in place of the thread_tick() call
+   its missing interrupt would have made, by crediting it to the
+   idle thread.  Called by the idle thread with interrupts off. */
+void
+thread_idle_tick (void) 
+{
+  ASSERT (thread_current () == idle_thread);
+
+  idle_ticks++;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -275,18 +299,21 @@ thread_unblock (struct thread *t)
  * "list_prepend" and "list_append" would have been much clearer.
  */
 
-  /* Insert the unblocked thread back into the ready list, ordered
-   * based on its priority */
-  list_insert_ordered (&ready_list, &t->elem, compare_priority, NULL);
+  /* Append the unblocked thread to the run queue for its priority */
+  ready_queue_push (t);
   t->status = THREAD_READY;
 
   struct thread *current = thread_current ();
 
   /*If the new thread added is a higher priority than the current thread
-   *the current thread yields */
+   *the current thread yields.  Inside an interrupt handler we can't
+   *yield directly, so ask for a yield once the handler returns. */
   if (current != idle_thread && t->priority > current->priority) 
     {
-      thread_yield ();
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
     }
 
   intr_set_level (old_level);
@@ -365,8 +392,8 @@ thread_yield (void)
 /* tom: see comment above on the misnamed "list_push_back" */
   if (cur != idle_thread) 
     {
-      /* Insert the current thread into the ready_list (ordered) */
-      list_insert_ordered (&ready_list, &cur->elem, compare_priority, NULL);
+      /* Put the current thread at the back of its priority's queue */
+      ready_queue_push (cur);
     }
   cur->status = THREAD_READY;
   schedule ();
@@ -439,21 +466,12 @@ thread_set_priority (int new_priority)
     cur->waiting_priority = new_priority;
   }
 
+  /* Yield if the priority of the current thread is changed so that
+   * it is lower than the priority of the best ready thread.*/
+  if (ready_queue_max_priority () > cur->priority)
+    thread_yield ();
+
   intr_set_level(old_level);
-  
-  //Add thread to ready list
-  if(!list_empty (&ready_list))
-  {
-    struct list_elem *next_elem = list_front (&ready_list);
-    struct thread *next_thread = list_entry (next_elem, struct thread, elem);  
-    
-    if (next_thread->priority > new_priority) 
-     {
-       /* Yield if the priority of the current thread is changed so that
-        * it is lower than the priority of the next thread.*/
-       thread_yield ();
-    }
-  }
 }
 
 /*
@@ -472,7 +490,7 @@ thread_set_priority_donated (struct thread *blocker_t, int priority) {
       int max_priority = blocker_t -> priority;
       if (priority > max_priority) 
         {
-          blocker_t -> priority = priority;
+          thread_change_priority (blocker_t, priority);
           max_priority = priority;
         }
  
@@ -557,8 +575,13 @@ idle (void *idle_started_ UNUSED)
     {
       /* Let someone else run. */
       intr_disable ();
+      timer_idle_exit ();
       thread_block ();
 
+      /* In tickless mode, stop the periodic timer interrupt
+         until the next alarm may be due. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -646,21 +669,86 @@ init_thread (struct thread *t, const char *name, int priority)
   intr_set_level (old_level);
 }
 
-/* Compares the priority fields of two threads, used when
- * setting their order in the ready list */
-static bool
-compare_priority(const struct list_elem *a,
-                 const struct list_elem *b,
-                 void *aux)
+/* Returns the index of the most significant set bit in MASK,
+   which must be nonzero. */
+static inline int
+highest_bit (uint64_t mask)
+{
+  uint32_t hi = mask >> 32;
+  uint32_t lo = mask;
+
+  ASSERT (mask != 0);
+  if (hi != 0)
+    return 63 - __builtin_clz (hi);
+  else
+    return 31 - __builtin_clz (lo);
+}
+
+/* Appends T to the back of the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_queue_push (struct thread *t)
 {
-  /* Grab the threads associated with the two ready_list elements */
-  struct thread *t1 = list_entry (a, struct thread, elem);
-  struct thread *t2 = list_entry (b, struct thread, elem);
+  int level = t->priority - PRI_MIN;
 
-  int a_prior = t1->priority;
-  int b_prior = t2->priority;
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  return a_prior > b_prior;
+  list_push_back (&ready_queues[level], &t->elem);
+  ready_mask |= (uint64_t) 1 << level;
+}
+
+/* Removes T, which must be in the run queue for its current
+   priority, from that queue.  Interrupts must be off. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  int level = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[level]))
+    ready_mask &= ~((uint64_t) 1 << level);
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   PRI_MIN - 1 if no thread is ready. */
+static int
+ready_queue_max_priority (void)
+{
+  if (ready_mask == 0)
+    return PRI_MIN - 1;
+  return highest_bit (ready_mask) + PRI_MIN;
+}
+
+/* Sets T's effective priority to PRIORITY.  If T is sitting in a
+   run queue it is moved to the back of the queue for its new
+   priority, and if it is waiting in a semaphore or condition
+   variable wait queue it is re-keyed in place, so that donations
+   take effect immediately. */
+void
+thread_change_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level = intr_disable ();
+  int old_priority = t->priority;
+
+  if (t->status == THREAD_READY && t != idle_thread)
+    {
+      ready_queue_remove (t);
+      t->priority = priority;
+      ready_queue_push (t);
+    }
+  else
+    {
+      t->priority = priority;
+      if (t->wait_queue != NULL && priority > old_priority)
+        pq_increase (t->wait_queue, t->wait_elem);
+      else if (t->wait_queue != NULL && priority < old_priority)
+        pq_update (t->wait_queue, t->wait_elem);
+    }
+
+  intr_set_level (old_level);
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -680,14 +768,21 @@ alloc_frame (struct thread *t, size_t size)
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.  The highest nonempty priority level is located
+   with a bit scan of ready_mask, so this takes constant time no
+   matter how many threads are ready. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  struct thread *t;
+
+  if (ready_mask == 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  t = list_entry (list_front (&ready_queues[highest_bit (ready_mask)]),
+                  struct thread, elem);
+  ready_queue_remove (t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -3,6 +3,7 @@
 
 #include <debug.h>
 #include <list.h>
+#include <pqueue.h>
 #include <stdint.h>
 
 /* States in a thread's life cycle. */
@@ -125,11 +126,12 @@ struct thread
    
     struct thread *blocker_thread;      /* If waiting for a lock, pointer to thread holding lock we need */
 
-    int64_t wakeup;                /* When timer should wake up */
-    struct list_elem sleep_elem;   /* For the sleep list */ 
 		
 		/* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct pq_elem waitelem;            /* Semaphore wait queue element. */
+    struct pqueue *wait_queue;          /* Wait queue we are in, if any. */
+    struct pq_elem *wait_elem;          /* Our element in wait_queue. */
 
     struct list lock_list;        /*list of locks this thread currently holds*/
 
@@ -151,6 +153,7 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_tick (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -173,6 +176,7 @@ void thread_foreach (thread_action_func *, void *);
 int thread_get_priority (void);
 void thread_set_priority (int);
 void thread_set_priority_donated(struct thread *blocker_t, int priority);
+void thread_change_priority (struct thread *, int priority);
 void thread_set_effective_priority (int);
 
 int thread_get_nice (void);
@@ -5,13 +5,21 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #endif
 
 /* Keyboard control register port. */
@@ -120,12 +128,20 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
+  slab_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  free_map_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  frame_print_stats ();
+  swap_print_stats ();
+#endif
 }
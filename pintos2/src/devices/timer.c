@@ -1,13 +1,14 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-  
+
 /* See [8254] for hardware details of the 8254 timer chip. */
 
 #if TIMER_FREQ < 19
@@ -20,50 +21,126 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
-/* Number of loops per timer tick.
-   Initialized by timer_calibrate(). */
-static unsigned loops_per_tick;
+/* Pending alarms are kept in a hierarchical timing wheel, as in
+   [Varghese87].  Level 0 has one slot per tick for the next
+   WHEEL_SLOTS ticks; each slot of level L covers WHEEL_SLOTS
+   times as many ticks as a slot of level L - 1.  Arming or
+   cancelling an alarm is a list insertion or removal.  Each tick
+   runs one level-0 slot, and every WHEEL_SLOTS ticks one slot of
+   the next level up is "cascaded", that is, its alarms are
+   re-sorted into the levels below, so expiry is amortized O(1)
+   per alarm. */
+#define WHEEL_BITS 6                            /* Bits per level. */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)           /* Slots per level. */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4                          /* Number of levels. */
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/* Next tick whose level-0 slot has not yet been run. */
+static int64_t wheel_tick;
+
+/* If true, the idle thread stops the periodic tick while it
+   waits, programming the PIT to interrupt only when the next
+   alarm may be due.  Controlled by kernel command-line option
+   "-tickless". */
+bool timer_tickless;
+
+/* Number of timer ticks the calibration loop measures. */
+#define CALIBRATE_TICKS 2
+
+/* Number of CPU time-stamp counter cycles per timer tick.
+   Initialized by timer_calibrate(); 0 until then. */
+static uint64_t tsc_per_tick;
+
+/* Time-stamp counter at the start of the current tick. */
+static uint64_t tick_tsc;
+
+/* True while PIT channel 0 is programmed for a single interrupt
+   rather than running periodically, and true if it was so
+   programmed by the idle thread. */
+static bool pit_oneshot;
+static bool idle_oneshot;
+
+/* Threads in a sub-tick sleep, ordered by deadline.  While this
+   is nonempty the PIT runs in one-shot mode, interrupting at
+   whichever comes first of the next tick boundary and the
+   earliest deadline. */
+struct hr_sleeper 
+  {
+    struct list_elem elem;      /* Element in hr_sleepers. */
+    uint64_t deadline;          /* Time-stamp counter deadline. */
+    struct thread *thread;      /* Sleeping thread. */
+  };
+static struct list hr_sleepers;
+
+/* Sub-tick sleeps shorter than this many microseconds busy-wait
+   instead of blocking, since an interrupt and two thread
+   switches would take longer than the sleep itself. */
+#define HR_SLEEP_MIN_US 20
 
 static intr_handler_func timer_interrupt;
-static bool too_many_loops (unsigned loops);
-static void busy_wait (int64_t loops);
+static uint64_t rdtsc (void);
+static int64_t catch_up (uint64_t now, bool in_interrupt);
+static void reprogram (bool idle);
+static void hr_sleep (int64_t num, int32_t denom);
+static bool hr_sleeper_less (const struct list_elem *,
+                             const struct list_elem *, void *aux);
+static void hr_wake (uint64_t now);
+static uint64_t real_time_cycles (int64_t num, int32_t denom);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct alarm *);
+static void wheel_cascade (int level);
+static void wheel_run (void);
+static int64_t wheel_next_due (int64_t max);
+static void wake_sleeper (void *t_);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  wheel_tick = 1;
+  list_init (&hr_sleepers);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates tsc_per_tick, the rate of the CPU's time-stamp
+   counter, used to implement brief delays, sub-tick sleeps and
+   timer_ns().  Counting cycles across a couple of ticks is much
+   quicker than searching for a busy-loop count that fills one. */
 void
 timer_calibrate (void) 
 {
-  unsigned high_bit, test_bit;
+  uint64_t start_tsc;
+  int64_t start;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
 
-  /* Approximate loops_per_tick as the largest power-of-two
-     still less than one timer tick. */
-  loops_per_tick = 1u << 10;
-  while (!too_many_loops (loops_per_tick << 1)) 
-    {
-      loops_per_tick <<= 1;
-      ASSERT (loops_per_tick != 0);
-    }
+  /* Wait for a timer tick. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
 
-  /* Refine the next 8 bits of loops_per_tick. */
-  high_bit = loops_per_tick;
-  for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
-    if (!too_many_loops (high_bit | test_bit))
-      loops_per_tick |= test_bit;
+  /* Count cycles across CALIBRATE_TICKS whole ticks. */
+  start_tsc = rdtsc ();
+  start = ticks;
+  while (ticks - start < CALIBRATE_TICKS)
+    barrier ();
+  tsc_per_tick = (rdtsc () - start_tsc) / CALIBRATE_TICKS;
+  ASSERT (tsc_per_tick != 0);
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+  printf ("%'"PRIu64" cycles/s.\n", tsc_per_tick * TIMER_FREQ);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -84,16 +161,130 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of nanoseconds since the OS booted.  The
+   result never decreases.  Between ticks it is interpolated with
+   the time-stamp counter, so before timer_calibrate() has run it
+   only has timer-tick resolution. */
+int64_t
+timer_ns (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  int64_t t = ticks;
+  uint64_t base = tick_tsc;
+  int64_t ns = t * (1000 * 1000 * 1000 / TIMER_FREQ);
+
+  if (tsc_per_tick != 0) 
+    {
+      /* Don't run past the next tick, in case its interrupt is
+         late, so that time never goes backward. */
+      uint64_t delta = rdtsc () - base;
+      if (delta > tsc_per_tick)
+        delta = tsc_per_tick;
+      ns += delta * (1000 * 1000 * 1000 / TIMER_FREQ) / tsc_per_tick;
+    }
+  intr_set_level (old_level);
+  return ns;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct alarm alarm;
+  enum intr_level old_level;
+
+  if (ticks <= 0) 
+    return;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+
+  /* Arm an alarm that unblocks us, then block.  Interrupts must
+     stay off in between so that the alarm can't fire before we
+     have actually blocked. */
+  alarm_init (&alarm, wake_sleeper, thread_current ());
+  old_level = intr_disable ();
+  alarm_arm (&alarm, timer_ticks () + ticks);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Alarm function used by timer_sleep() to wake up sleeping
+   thread T_. */
+static void
+wake_sleeper (void *t_) 
+{
+  thread_unblock (t_);
+}
+
+/* Initializes ALARM, which is not yet armed, so that FUNC will be
+   called with AUX when it goes off. */
+void
+alarm_init (struct alarm *alarm, alarm_func *func, void *aux) 
+{
+  ASSERT (alarm != NULL);
+  ASSERT (func != NULL);
+
+  alarm->expires = 0;
+  alarm->func = func;
+  alarm->aux = aux;
+  alarm->armed = false;
+}
+
+/* Arms ALARM to go off at timer tick WHEN, as returned by
+   timer_ticks().  If WHEN has already passed, it goes off at the
+   next timer tick.  Re-arming an alarm that is already pending
+   moves its deadline.
+
+   The alarm function runs in the timer interrupt handler, so it
+   must not sleep.  It may re-arm its own alarm.
+
+   This function may be called from an interrupt handler. */
+void
+alarm_arm (struct alarm *alarm, int64_t when) 
+{
+  enum intr_level old_level;
+
+  ASSERT (alarm != NULL);
+
+  old_level = intr_disable ();
+  if (alarm->armed)
+    list_remove (&alarm->elem);
+  alarm->expires = when;
+  alarm->armed = true;
+  wheel_insert (alarm);
+  intr_set_level (old_level);
+}
+
+/* Disarms ALARM.  Returns true if it was pending, false if it
+   had already gone off or was never armed.
+
+   This function may be called from an interrupt handler. */
+bool
+alarm_cancel (struct alarm *alarm) 
+{
+  enum intr_level old_level;
+  bool was_armed;
+
+  ASSERT (alarm != NULL);
+
+  old_level = intr_disable ();
+  was_armed = alarm->armed;
+  if (was_armed) 
+    {
+      list_remove (&alarm->elem);
+      alarm->armed = false;
+    }
+  intr_set_level (old_level);
+
+  return was_armed;
+}
+
+/* Returns true if ALARM is armed and has not yet gone off. */
+bool
+alarm_pending (const struct alarm *alarm) 
+{
+  return alarm->armed;
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -166,45 +357,307 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  In tickless mode, stops the periodic tick
+   and arms a single interrupt for the next tick on which an
+   alarm may be due. */
+void
+timer_idle_enter (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (timer_tickless && tsc_per_tick != 0) 
+    {
+      reprogram (true);
+      idle_oneshot = true;
+    }
+}
+
+/* Called by the idle thread, with interrupts off, when it wakes
+   up.  If some interrupt other than the timer's woke the CPU
+   early, catches up on the ticks that went by while it was
+   halted, doing the work their interrupts would have done, so
+   that the thread about to run sees the right time and any
+   alarms that came due go off, and resumes ticking from the next
+   tick boundary. */
+void
+timer_idle_exit (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idle_oneshot) 
+    {
+      idle_oneshot = false;
+      catch_up (rdtsc (), false);
+      wheel_run ();
+      reprogram (false);
+    }
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  if (pit_oneshot) 
+    {
+      /* Any number of tick boundaries may have gone by since the
+         PIT was programmed: several if the CPU was idle, none if
+         this interrupt is for a sub-tick sleeper. */
+      uint64_t now = rdtsc ();
+
+      pit_oneshot = idle_oneshot = false;
+      catch_up (now, true);
+      hr_wake (now);
+      reprogram (false);
+    }
+  else 
+    {
+      ticks++;
+      tick_tsc = rdtsc ();
+      thread_tick ();
+    }
+  wheel_run ();
+}
+
+/* Reads the CPU's time-stamp counter. */
+static uint64_t
+rdtsc (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Advances the tick count past every tick boundary up to time-
+   stamp counter value NOW, and returns the number of ticks that
+   were added.  Each tick is accounted for as the periodic timer
+   interrupt would have: by thread_tick() if IN_INTERRUPT, and
+   otherwise, in the idle thread, by thread_idle_tick().
+   Interrupts must be off. */
+static int64_t
+catch_up (uint64_t now, bool in_interrupt) 
+{
+  int64_t cnt = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (now - tick_tsc >= tsc_per_tick) 
+    {
+      tick_tsc += tsc_per_tick;
+      ticks++;
+      cnt++;
+      if (in_interrupt)
+        thread_tick ();
+      else
+        thread_idle_tick ();
+    }
+  return cnt;
 }
 
-/* Returns true if LOOPS iterations waits for more than one timer
-   tick, otherwise false. */
+/* Programs PIT channel 0 for the next timer event.  The PIT
+   normally runs periodically at TIMER_FREQ, but is put into
+   one-shot mode while a sub-tick sleeper is waiting, while the
+   CPU is IDLE in tickless mode, and to get back in phase with
+   the tick boundaries after either.  Interrupts must be off. */
+static void
+reprogram (bool idle) 
+{
+  uint64_t now = rdtsc ();
+  uint64_t next;
+  uint64_t count;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idle)
+    {
+      /* The longest one-shot interval the PIT can count. */
+      int64_t max = 65535 * (int64_t) TIMER_FREQ / PIT_HZ;
+      next = tick_tsc + wheel_next_due (max > 1 ? max : 1) * tsc_per_tick;
+    }
+  else
+    next = tick_tsc + tsc_per_tick;
+
+  if (!list_empty (&hr_sleepers)) 
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline < next)
+        next = s->deadline;
+    }
+  else if (!idle && now - tick_tsc < tsc_per_tick / 8) 
+    {
+      /* Nothing special to wait for and we're at a tick boundary,
+         so go back to ticking periodically. */
+      if (pit_oneshot)
+        pit_configure_channel (0, 2, TIMER_FREQ);
+      pit_oneshot = false;
+      return;
+    }
+
+  /* Convert from time-stamp counter cycles to PIT cycles,
+     rounding up so as not to interrupt too early. */
+  if (next > now)
+    count = DIV_ROUND_UP ((next - now) * PIT_HZ, tsc_per_tick * TIMER_FREQ);
+  else
+    count = 1;
+  pit_configure_oneshot (0, count < 65535 ? count : 65535);
+  pit_oneshot = true;
+}
+
+/* Blocks the current thread for NUM/DENOM seconds, which must be
+   less than one timer tick. */
+static void
+hr_sleep (int64_t num, int32_t denom) 
+{
+  struct hr_sleeper s;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  s.deadline = rdtsc () + real_time_cycles (num, denom);
+  s.thread = thread_current ();
+  list_insert_ordered (&hr_sleepers, &s.elem, hr_sleeper_less, NULL);
+  reprogram (false);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Returns true if sub-tick sleeper A_ has an earlier deadline
+   than B_. */
 static bool
-too_many_loops (unsigned loops) 
+hr_sleeper_less (const struct list_elem *a_, const struct list_elem *b_,
+                 void *aux UNUSED) 
 {
-  /* Wait for a timer tick. */
-  int64_t start = ticks;
-  while (ticks == start)
-    barrier ();
+  const struct hr_sleeper *a = list_entry (a_, struct hr_sleeper, elem);
+  const struct hr_sleeper *b = list_entry (b_, struct hr_sleeper, elem);
 
-  /* Run LOOPS loops. */
-  start = ticks;
-  busy_wait (loops);
+  return a->deadline < b->deadline;
+}
+
+/* Wakes up every sub-tick sleeper whose deadline is at or
+   before time-stamp counter value NOW. */
+static void
+hr_wake (uint64_t now) 
+{
+  while (!list_empty (&hr_sleepers)) 
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline > now)
+        break;
+      list_pop_front (&hr_sleepers);
+      thread_unblock (s->thread);
+    }
+}
+
+/* Files ALARM into the wheel slot that covers its deadline.
+   Interrupts must be off. */
+static void
+wheel_insert (struct alarm *alarm) 
+{
+  int64_t expires = alarm->expires;
+  int64_t delta = expires - wheel_tick;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  /* If the tick count changed, we iterated too long. */
-  barrier ();
-  return start != ticks;
+  if (delta < 0)
+    {
+      /* Already due: run it with the next slot. */
+      expires = wheel_tick;
+      delta = 0;
+    }
+  else if (delta >= WHEEL_SPAN)
+    {
+      /* Beyond the wheel's reach: park it in the farthest slot.
+         It is re-filed, using its real deadline, when that slot
+         is cascaded. */
+      expires = wheel_tick + WHEEL_SPAN - 1;
+      delta = WHEEL_SPAN - 1;
+    }
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & WHEEL_MASK],
+                  &alarm->elem);
 }
 
-/* Iterates through a simple loop LOOPS times, for implementing
-   brief delays.
+/* Re-files every alarm in the current slot of LEVEL into the
+   levels below it.  If that slot is slot 0, the current slot of
+   the next level up is due as well. */
+static void
+wheel_cascade (int level) 
+{
+  int slot = (wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  struct list *list = &wheel[level][slot];
+  struct list due;
+
+  if (slot == 0 && level + 1 < WHEEL_LEVELS)
+    wheel_cascade (level + 1);
+
+  /* Move the slot aside first, so that an alarm parked beyond
+     the wheel's span can land back in this same level. */
+  list_init (&due);
+  list_splice (list_end (&due), list_begin (list), list_end (list));
+  while (!list_empty (&due))
+    wheel_insert (list_entry (list_pop_front (&due), struct alarm, elem));
+}
 
-   Marked NO_INLINE because code alignment can significantly
-   affect timings, so that if this function was inlined
-   differently in different places the results would be difficult
-   to predict. */
-static void NO_INLINE
-busy_wait (int64_t loops) 
+/* Runs the alarms for every tick up to and including the
+   current one.  Called from the timer interrupt handler. */
+static void
+wheel_run (void) 
 {
-  while (loops-- > 0)
-    barrier ();
+  while (wheel_tick <= ticks) 
+    {
+      struct list *list = &wheel[0][wheel_tick & WHEEL_MASK];
+      struct list due;
+
+      if ((wheel_tick & WHEEL_MASK) == 0)
+        wheel_cascade (1);
+
+      /* Take the slot's alarms and advance past it before calling
+         any of them, so that an alarm function that re-arms for
+         an already-passed tick doesn't land back in this slot. */
+      list_init (&due);
+      list_splice (list_end (&due), list_begin (list), list_end (list));
+      wheel_tick++;
+
+      while (!list_empty (&due)) 
+        {
+          struct alarm *alarm = list_entry (list_pop_front (&due),
+                                            struct alarm, elem);
+          alarm->armed = false;
+          alarm->func (alarm->aux);
+        }
+    }
+}
+
+/* Returns the number of ticks from now, at least 1 and at most
+   MAX, until the next tick on which an alarm may be due.  A tick
+   that cascades a higher wheel level counts as possibly due. */
+static int64_t
+wheel_next_due (int64_t max) 
+{
+  int64_t t;
+
+  for (t = wheel_tick; t < ticks + max; t++)
+    if ((t & WHEEL_MASK) == 0 || !list_empty (&wheel[0][t & WHEEL_MASK]))
+      break;
+  return t > ticks ? t - ticks : 1;
+}
+
+/* Returns the number of time-stamp counter cycles in NUM/DENOM
+   seconds. */
+static uint64_t
+real_time_cycles (int64_t num, int32_t denom) 
+{
+  /* Scale the numerator and denominator down by 1000 to avoid
+     the possibility of overflow. */
+  ASSERT (denom % 1000 == 0);
+  return tsc_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000);
 }
 
 /* Sleep for approximately NUM/DENOM seconds. */
@@ -227,10 +680,15 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (tsc_per_tick != 0
+           && num * 1000 * 1000 >= (int64_t) HR_SLEEP_MIN_US * denom)
+    {
+      /* Block until a one-shot PIT interrupt at the deadline. */
+      hr_sleep (num, denom);
+    }
   else 
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
+      /* Too short to be worth blocking for: busy-wait. */
       real_time_delay (num, denom); 
     }
 }
@@ -239,8 +697,9 @@ real_time_sleep (int64_t num, int32_t denom)
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
-  /* Scale the numerator and denominator down by 1000 to avoid
-     the possibility of overflow. */
-  ASSERT (denom % 1000 == 0);
-  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
+  uint64_t cycles = real_time_cycles (num, denom);
+  uint64_t start = rdtsc ();
+
+  while (rdtsc () - start < cycles)
+    barrier ();
 }
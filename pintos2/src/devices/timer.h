@@ -1,17 +1,23 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Stop the periodic tick while idle?  (-tickless) */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_ns (void);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -19,6 +25,24 @@ void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+/* Alarms: one-shot callbacks at a given timer tick, for
+   timeouts in other subsystems. */
+typedef void alarm_func (void *aux);
+
+struct alarm 
+  {
+    struct list_elem elem;      /* Element in a timing wheel slot. */
+    int64_t expires;            /* Timer tick at which to go off. */
+    alarm_func *func;           /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    bool armed;                 /* True if pending. */
+  };
+
+void alarm_init (struct alarm *, alarm_func *, void *aux);
+void alarm_arm (struct alarm *, int64_t when);
+bool alarm_cancel (struct alarm *);
+bool alarm_pending (const struct alarm *);
+
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
@@ -26,4 +50,8 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,437 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Buffer cache.
+
+   All file system I/O goes through a cache of CACHE_SIZE
+   sectors, indexed by sector number in a hash table.  When a
+   sector that is not cached is needed, a slot is reclaimed with
+   the clock algorithm.  Writes only mark a slot dirty; a flusher
+   thread writes dirty slots back every FLUSH_INTERVAL, and
+   filesys_done() writes back whatever is left.
+
+   cache_lock protects the hash table, the clock hand, and each
+   slot's sector, valid flag, pin count and accessed bit.  A slot
+   is pinned while anyone is using it, and pinned slots are never
+   evicted.  A slot's own lock is held while its data is being
+   read, written or transferred to or from disk, so a thread that
+   finds a slot still being filled waits on that lock.
+
+   cache_readahead() queues a sector to be read in by a separate
+   readahead thread, so that the caller does not wait for it. */
+
+/* Ticks between write-behind passes of the flusher thread. */
+#define FLUSH_INTERVAL (TIMER_FREQ)
+
+/* Maximum number of queued readahead requests.  Requests made
+   while the queue is full are dropped. */
+#define READAHEAD_MAX 32
+
+/* A cached sector. */
+struct cache_slot 
+  {
+    struct hash_elem elem;              /* Element in `slots_by_sector'. */
+    block_sector_t sector;              /* Sector cached, if valid. */
+    bool valid;                         /* In `slots_by_sector'? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int pin_cnt;                        /* Number of users. */
+
+    struct lock lock;                   /* Protects the members below. */
+    bool dirty;                         /* Newer than the disk copy? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+bool cache_enabled = true;
+
+static struct cache_slot slots[CACHE_SIZE];
+static struct hash slots_by_sector;     /* Valid slots, by sector. */
+static size_t clock_hand;               /* Next slot to consider evicting. */
+static struct lock cache_lock;          /* See the comment at top of file. */
+static struct condition slot_unpinned;  /* Signaled when a slot is unpinned. */
+
+/* Readahead queue, a ring buffer protected by cache_lock. */
+static block_sector_t readahead_queue[READAHEAD_MAX];
+static size_t readahead_head;           /* Index of oldest request. */
+static size_t readahead_cnt;            /* Number of queued requests. */
+static struct condition readahead_ready; /* Signaled when a request is queued. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups that found the sector. */
+static long long miss_cnt;              /* Lookups that had to evict. */
+static long long write_back_cnt;        /* Dirty sectors written to disk. */
+static long long prefetch_cnt;          /* Sectors read in by readahead. */
+
+static hash_hash_func slot_hash;
+static hash_less_func slot_less;
+static struct cache_slot *acquire_slot (block_sector_t, bool read);
+static void release_slot (struct cache_slot *, bool dirty);
+static struct cache_slot *evict_slot (void);
+static void write_back (struct cache_slot *);
+static thread_func flusher;
+static thread_func readahead_daemon;
+
+/* Initializes the buffer cache and starts its flusher and
+   readahead threads. */
+void
+cache_init (void) 
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&slot_unpinned);
+  cond_init (&readahead_ready);
+  if (!hash_init (&slots_by_sector, slot_hash, slot_less, NULL))
+    PANIC ("can't allocate buffer cache index");
+  for (i = 0; i < CACHE_SIZE; i++)
+    lock_init (&slots[i].lock);
+
+  if (cache_enabled) 
+    {
+      thread_create ("cache-flush", PRI_DEFAULT, flusher, NULL);
+      thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+    }
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer) 
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within sector
+   SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size) 
+{
+  struct cache_slot *s;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  if (!cache_enabled) 
+    {
+      uint8_t bounce[BLOCK_SECTOR_SIZE];
+      block_read (fs_device, sector, bounce);
+      memcpy (buffer, bounce + ofs, size);
+      return;
+    }
+
+  s = acquire_slot (sector, true);
+  memcpy (buffer, s->data + ofs, size);
+  release_slot (s, false);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer) 
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to byte offset OFS within sector
+   SECTOR.  The rest of the sector is unchanged. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size) 
+{
+  struct cache_slot *s;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  if (!cache_enabled) 
+    {
+      uint8_t bounce[BLOCK_SECTOR_SIZE];
+      if (size < BLOCK_SECTOR_SIZE)
+        block_read (fs_device, sector, bounce);
+      memcpy (bounce + ofs, buffer, size);
+      block_write (fs_device, sector, bounce);
+      return;
+    }
+
+  /* A write of a whole sector need not read it first. */
+  s = acquire_slot (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (s->data + ofs, buffer, size);
+  release_slot (s, true);
+}
+
+/* Asks for SECTOR to be read into the cache in the background.
+   Does nothing if SECTOR is already cached or too many requests
+   are already pending. */
+void
+cache_readahead (block_sector_t sector) 
+{
+  struct cache_slot key;
+
+  if (!cache_enabled)
+    return;
+
+  lock_acquire (&cache_lock);
+  key.sector = sector;
+  if (readahead_cnt < READAHEAD_MAX
+      && hash_find (&slots_by_sector, &key.elem) == NULL) 
+    {
+      readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_MAX]
+        = sector;
+      cond_signal (&readahead_ready, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector in the cache back to disk. */
+void
+cache_flush (void) 
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++) 
+    {
+      struct cache_slot *s = &slots[i];
+
+      lock_acquire (&cache_lock);
+      if (!s->valid) 
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      s->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&s->lock);
+      write_back (s);
+      release_slot (s, false);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) 
+{
+  if (cache_enabled)
+    printf ("Cache: %lld hits, %lld misses, %lld write-backs, "
+            "%lld prefetched\n",
+            hit_cnt, miss_cnt, write_back_cnt, prefetch_cnt);
+}
+
+/* Returns the slot caching SECTOR, pinned and with its lock held,
+   reading the sector from disk first if READ is true and the
+   sector is not already cached.  If READ is false and the sector
+   is not cached, the slot's data is garbage and the caller must
+   overwrite all of it. */
+static struct cache_slot *
+acquire_slot (block_sector_t sector, bool read) 
+{
+  struct cache_slot key, *s;
+  struct hash_elem *e;
+
+  lock_acquire (&cache_lock);
+  key.sector = sector;
+  for (;;) 
+    {
+      e = hash_find (&slots_by_sector, &key.elem);
+      if (e != NULL) 
+        {
+          /* Hit.  If another thread is still filling the slot, we
+             wait for it on the slot's lock. */
+          s = hash_entry (e, struct cache_slot, elem);
+          s->pin_cnt++;
+          s->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&s->lock);
+          return s;
+        }
+
+      /* Miss.  evict_slot() may release cache_lock, so another
+         thread may have brought SECTOR in meanwhile, in which
+         case the slot just freed is simply left free. */
+      s = evict_slot ();
+      if (hash_find (&slots_by_sector, &key.elem) == NULL)
+        break;
+    }
+
+  /* Claim the slot and take its lock before making it visible
+     under its new sector, so that other threads looking for the
+     sector wait until it has been read. */
+  s->sector = sector;
+  s->valid = true;
+  s->accessed = true;
+  s->pin_cnt = 1;
+  hash_insert (&slots_by_sector, &s->elem);
+  miss_cnt++;
+  lock_acquire (&s->lock);
+  lock_release (&cache_lock);
+
+  if (read)
+    block_read (fs_device, sector, s->data);
+  s->dirty = false;
+  return s;
+}
+
+/* Releases slot S, which the caller acquired with
+   acquire_slot(), marking it dirty if DIRTY is true. */
+static void
+release_slot (struct cache_slot *s, bool dirty) 
+{
+  if (dirty)
+    s->dirty = true;
+  lock_release (&s->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (s->pin_cnt > 0);
+  if (--s->pin_cnt == 0)
+    cond_signal (&slot_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Chooses an unpinned, clean slot with the clock algorithm,
+   removes it from the index, and returns it.  Waits for a slot
+   to be unpinned if all of them are in use.  cache_lock must be
+   held, but is released while waiting or writing.
+
+   A dirty victim is pinned and written back under its own lock
+   only, with cache_lock released, so that other lookups do not
+   wait for the disk.  It stays in the index meanwhile, so a
+   thread that looks up its sector finds it rather than a stale
+   copy on disk, and pins it.  Once the write is done the victim
+   is reused only if it is still unpinned, clean and unused. */
+static struct cache_slot *
+evict_slot (void) 
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;) 
+    {
+      size_t i;
+
+      /* Two trips around the clock find an unpinned slot if
+         there is one: the first clears accessed bits. */
+      for (i = 0; i < 2 * CACHE_SIZE; i++) 
+        {
+          struct cache_slot *s = &slots[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+          if (s->pin_cnt > 0)
+            continue;
+          if (s->valid && s->accessed) 
+            {
+              s->accessed = false;
+              continue;
+            }
+
+          /* Unpinned, so no one holds its lock, and `dirty' can
+             be read. */
+          if (s->valid && s->dirty) 
+            {
+              s->pin_cnt++;
+              lock_release (&cache_lock);
+              lock_acquire (&s->lock);
+              write_back (s);
+              lock_release (&s->lock);
+              lock_acquire (&cache_lock);
+              if (--s->pin_cnt > 0 || s->dirty || s->accessed) 
+                {
+                  if (s->pin_cnt == 0)
+                    cond_signal (&slot_unpinned, &cache_lock);
+                  continue;
+                }
+            }
+
+          if (s->valid) 
+            {
+              hash_delete (&slots_by_sector, &s->elem);
+              s->valid = false;
+            }
+          return s;
+        }
+
+      cond_wait (&slot_unpinned, &cache_lock);
+    }
+}
+
+/* Writes slot S back to disk if it is dirty.  S's lock must be
+   held. */
+static void
+write_back (struct cache_slot *s) 
+{
+  ASSERT (lock_held_by_current_thread (&s->lock));
+
+  if (s->dirty) 
+    {
+      block_write (fs_device, s->sector, s->data);
+      s->dirty = false;
+      write_back_cnt++;
+    }
+}
+
+/* Flusher thread.  Writes dirty sectors behind, so that they are
+   usually clean by the time they are evicted and little is lost
+   in a crash.  Also writes out the free map's changes, which are
+   batched until then. */
+static void
+flusher (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      free_map_sync ();
+      cache_flush ();
+    }
+}
+
+/* Readahead thread.  Reads in the sectors queued by
+   cache_readahead(), oldest first. */
+static void
+readahead_daemon (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      struct cache_slot key;
+      block_sector_t sector;
+      bool cached;
+
+      lock_acquire (&cache_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_ready, &cache_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_MAX;
+      readahead_cnt--;
+
+      /* A reader may have gotten there first. */
+      key.sector = sector;
+      cached = hash_find (&slots_by_sector, &key.elem) != NULL;
+      if (!cached)
+        prefetch_cnt++;
+      lock_release (&cache_lock);
+
+      if (!cached)
+        release_slot (acquire_slot (sector, true), false);
+    }
+}
+
+/* Returns a hash value for the sector cached in slot E. */
+static unsigned
+slot_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct cache_slot *s = hash_entry (e, struct cache_slot, elem);
+  return hash_int (s->sector);
+}
+
+/* Returns true if slot A caches a lower-numbered sector than
+   slot B. */
+static bool
+slot_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED) 
+{
+  const struct cache_slot *a = hash_entry (a_, struct cache_slot, elem);
+  const struct cache_slot *b = hash_entry (b_, struct cache_slot, elem);
+  return a->sector < b->sector;
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* If true (default), file system sectors are cached.
+   Controlled by kernel command-line option "-no-cache". */
+extern bool cache_enabled;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
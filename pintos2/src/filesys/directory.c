@@ -1,10 +1,12 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,11 +23,69 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of a directory's entries.  Built the first
+   time the directory is opened and kept up to date by dir_add()
+   and dir_remove(), so that finding a name, or a free slot for a
+   new one, does not scan the directory on disk.  If memory runs
+   out, the index is dropped and the directory is scanned as
+   before. */
+struct dir_index 
+  {
+    struct list_elem elem;              /* Element in `dir_indexes'. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    struct hash entries;                /* In-use entries, by name. */
+    struct list free_slots;             /* Free entries. */
+    off_t end;                          /* Offset past the last entry. */
+  };
+
+/* A directory entry in a dir_index. */
+struct index_entry 
+  {
+    struct hash_elem hash_elem;         /* In `entries', if in use. */
+    struct list_elem list_elem;         /* In `free_slots', if free. */
+    off_t ofs;                          /* Byte offset in directory. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Indexes of all directories opened so far. */
+static struct list dir_indexes;
+
+/* Serializes changes to directory contents against each other
+   and against lookups, which may proceed in parallel.  Also
+   protects dir_indexes and the indexes on it. */
+static struct rwlock dir_rwlock;
+
+static struct dir_index *find_index (block_sector_t);
+static struct dir_index *build_index (struct inode *);
+static void free_index (struct dir_index *);
+
+/* Initializes the directory module. */
+void
+dir_init (void) 
+{
+  list_init (&dir_indexes);
+  rwlock_init (&dir_rwlock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
+  struct dir_index *index;
+
+  /* Forget any index left over from a directory that used to
+     live in SECTOR. */
+  rwlock_acquire_write (&dir_rwlock);
+  index = find_index (sector);
+  if (index != NULL) 
+    {
+      list_remove (&index->elem);
+      free_index (index);
+    }
+  rwlock_release_write (&dir_rwlock);
+
   return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -37,8 +97,28 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      block_sector_t sector = inode_get_inumber (inode);
+      struct dir_index *index;
+
       dir->inode = inode;
       dir->pos = 0;
+
+      /* Index the directory if this is the first time it has
+         been opened. */
+      rwlock_acquire_read (&dir_rwlock);
+      index = find_index (sector);
+      rwlock_release_read (&dir_rwlock);
+      if (index == NULL) 
+        {
+          rwlock_acquire_write (&dir_rwlock);
+          if (find_index (sector) == NULL) 
+            {
+              index = build_index (inode);
+              if (index != NULL)
+                list_push_front (&dir_indexes, &index->elem);
+            }
+          rwlock_release_write (&dir_rwlock);
+        }
       return dir;
     }
   else
@@ -92,12 +172,35 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  struct dir_index *index;
   struct dir_entry e;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  index = find_index (inode_get_inumber (dir->inode));
+  if (index != NULL) 
+    {
+      struct index_entry key, *ie;
+      struct hash_elem *he;
+
+      strlcpy (key.name, name, sizeof key.name);
+      he = hash_find (&index->entries, &key.hash_elem);
+      if (he == NULL)
+        return false;
+      ie = hash_entry (he, struct index_entry, hash_elem);
+      if (ep != NULL) 
+        {
+          ep->inode_sector = ie->inode_sector;
+          strlcpy (ep->name, ie->name, sizeof ep->name);
+          ep->in_use = true;
+        }
+      if (ofsp != NULL)
+        *ofsp = ie->ofs;
+      return true;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -124,10 +227,12 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  rwlock_acquire_read (&dir_rwlock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  rwlock_release_read (&dir_rwlock);
 
   return *inode != NULL;
 }
@@ -141,6 +246,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
+  struct index_entry *ie = NULL;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -152,10 +259,34 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  rwlock_acquire_write (&dir_rwlock);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
+  /* Take a free slot from the index, or a new one at the end of
+     the directory. */
+  index = find_index (inode_get_inumber (dir->inode));
+  if (index != NULL) 
+    {
+      if (!list_empty (&index->free_slots))
+        ie = list_entry (list_pop_front (&index->free_slots),
+                         struct index_entry, list_elem);
+      else 
+        {
+          ie = malloc (sizeof *ie);
+          if (ie != NULL)
+            ie->ofs = index->end;
+          else 
+            {
+              list_remove (&index->elem);
+              free_index (index);
+              index = NULL;
+            }
+        }
+    }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -163,10 +294,13 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  if (ie != NULL)
+    ofs = ie->ofs;
+  else
+    for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+         ofs += sizeof e) 
+      if (!e.in_use)
+        break;
 
   /* Write slot. */
   e.in_use = true;
@@ -174,7 +308,25 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Update the index. */
+  if (ie != NULL) 
+    {
+      if (success) 
+        {
+          ie->inode_sector = inode_sector;
+          strlcpy (ie->name, name, sizeof ie->name);
+          hash_insert (&index->entries, &ie->hash_elem);
+          if (ofs == index->end)
+            index->end += sizeof e;
+        }
+      else if (ofs < index->end)
+        list_push_front (&index->free_slots, &ie->list_elem);
+      else
+        free (ie);
+    }
+
  done:
+  rwlock_release_write (&dir_rwlock);
   return success;
 }
 
@@ -184,6 +336,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_index *index;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -192,6 +345,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  rwlock_acquire_write (&dir_rwlock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -206,11 +361,24 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  /* Move it to the index's free slots. */
+  index = find_index (inode_get_inumber (dir->inode));
+  if (index != NULL) 
+    {
+      struct index_entry key, *ie;
+
+      strlcpy (key.name, name, sizeof key.name);
+      ie = hash_entry (hash_delete (&index->entries, &key.hash_elem),
+                       struct index_entry, hash_elem);
+      list_push_front (&index->free_slots, &ie->list_elem);
+    }
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  rwlock_release_write (&dir_rwlock);
   inode_close (inode);
   return success;
 }
@@ -222,15 +390,114 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  rwlock_acquire_read (&dir_rwlock);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  rwlock_release_read (&dir_rwlock);
+  return success;
+}
+
+/* Returns a hash value for index entry E. */
+static unsigned
+index_entry_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct index_entry *ie = hash_entry (e, struct index_entry, hash_elem);
+  return hash_string (ie->name);
+}
+
+/* Returns true if index entry A's name precedes B's. */
+static bool
+index_entry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED) 
+{
+  const struct index_entry *a = hash_entry (a_, struct index_entry, hash_elem);
+  const struct index_entry *b = hash_entry (b_, struct index_entry, hash_elem);
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the index for the directory whose inode is in SECTOR,
+   or a null pointer if it has none.  dir_rwlock must be held. */
+static struct dir_index *
+find_index (block_sector_t sector) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&dir_indexes); e != list_end (&dir_indexes);
+       e = list_next (e)) 
+    {
+      struct dir_index *index = list_entry (e, struct dir_index, elem);
+      if (index->sector == sector)
+        return index;
+    }
+  return NULL;
+}
+
+/* Reads the directory in INODE and returns a new index for it,
+   or a null pointer if memory runs out. */
+static struct dir_index *
+build_index (struct inode *inode) 
+{
+  struct dir_index *index;
+  struct dir_entry e;
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    return NULL;
+  if (!hash_init (&index->entries, index_entry_hash, index_entry_less, NULL)) 
+    {
+      free (index);
+      return NULL;
+    }
+  index->sector = inode_get_inumber (inode);
+  list_init (&index->free_slots);
+
+  for (index->end = 0;
+       inode_read_at (inode, &e, sizeof e, index->end) == sizeof e;
+       index->end += sizeof e) 
+    {
+      struct index_entry *ie = malloc (sizeof *ie);
+      if (ie == NULL) 
+        {
+          free_index (index);
+          return NULL;
+        }
+      ie->ofs = index->end;
+      if (e.in_use) 
+        {
+          ie->inode_sector = e.inode_sector;
+          strlcpy (ie->name, e.name, sizeof ie->name);
+          hash_insert (&index->entries, &ie->hash_elem);
+        }
+      else
+        list_push_back (&index->free_slots, &ie->list_elem);
+    }
+  return index;
+}
+
+/* Frees index entry E. */
+static void
+free_index_entry (struct hash_elem *e, void *aux UNUSED) 
+{
+  free (hash_entry (e, struct index_entry, hash_elem));
+}
+
+/* Frees INDEX, which must not be on dir_indexes. */
+static void
+free_index (struct dir_index *index) 
+{
+  hash_destroy (&index->entries, free_index_entry);
+  while (!list_empty (&index->free_slots))
+    free (list_entry (list_pop_front (&index->free_slots),
+                      struct index_entry, list_elem));
+  free (index);
 }
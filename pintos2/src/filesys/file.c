@@ -1,7 +1,15 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "devices/block.h"
+#include "threads/slab.h"
+
+/* Readahead window sizes, in bytes.  A file read sequentially
+   with file_read_ahead() starts with a window of RA_MIN bytes,
+   which doubles on each further sequential read up to RA_MAX.
+   Any other read closes the window. */
+#define RA_MIN (2 * BLOCK_SECTOR_SIZE)
+#define RA_MAX (16 * BLOCK_SECTOR_SIZE)
 
 /* An open file. */
 
@@ -10,26 +18,44 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Offset a sequential read would start at. */
+    off_t ra_window;            /* Readahead window size, in bytes. */
+    off_t ra_end;               /* End of data already read ahead. */
   };
 
+static void readahead (struct file *, off_t size, off_t file_ofs);
+
+/* Cache of open files. */
+static struct slab_cache file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) 
+{
+  slab_cache_init (&file_cache, "file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = slab_alloc (&file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_window = 0;
+      file->ra_end = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      slab_free (&file_cache, file);
       return NULL; 
     }
 }
@@ -50,7 +76,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      slab_free (&file_cache, file);
     }
 }
 
@@ -69,11 +95,26 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = file_read_at (file, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Like file_read(), but also reads ahead of FILE's position in
+   the background once FILE is being read sequentially.  This is
+   for the read() system call.  Page faults read executable and
+   memory mapped pages one at a time with file_read(), and leave
+   the buffer cache alone beyond that, since the VM system does
+   its own readahead. */
+off_t
+file_read_ahead (struct file *file, void *buffer, off_t size) 
+{
+  off_t file_ofs = file->pos;
+  off_t bytes_read = file_read (file, buffer, size);
+  readahead (file, bytes_read, file_ofs);
+  return bytes_read;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -85,6 +126,42 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Updates FILE's readahead window after a read of SIZE bytes at
+   FILE_OFS and starts reading ahead whatever part of the window
+   has not been read ahead already. */
+static void
+readahead (struct file *file, off_t size, off_t file_ofs) 
+{
+  off_t end = file_ofs + size;
+
+  if (file_ofs == file->ra_next && size > 0) 
+    {
+      /* Sequential: open or widen the window. */
+      if (file->ra_window == 0)
+        file->ra_window = RA_MIN;
+      else if (file->ra_window < RA_MAX)
+        file->ra_window *= 2;
+    }
+  else 
+    {
+      /* Random: close the window. */
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = end;
+
+  if (file->ra_window > 0) 
+    {
+      off_t start = file->ra_end > end ? file->ra_end : end;
+      off_t limit = end + file->ra_window;
+      if (start < limit) 
+        {
+          inode_readahead (file->inode, limit - start, start);
+          file->ra_end = limit;
+        }
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
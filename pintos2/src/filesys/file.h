@@ -5,6 +5,8 @@
 
 struct inode;
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -13,6 +15,7 @@ struct inode *file_get_inode (struct file *);
 
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
+off_t file_read_ahead (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
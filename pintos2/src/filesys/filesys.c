@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -21,8 +22,13 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  inode_init ();
+  /* The cache's flusher thread syncs the free map, so the free
+     map comes first. */
   free_map_init ();
+  cache_init ();
+  inode_init ();
+  file_init ();
+  dir_init ();
 
   if (format) 
     do_format ();
@@ -36,6 +42,7 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -1,20 +1,42 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the members below. */
+
+/* Number of free map bits in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors of the free map file that differ from free_map, one bit
+   per sector.  Allocating and releasing only mark sectors dirty;
+   free_map_sync() writes them. */
+static struct bitmap *dirty_sectors;
+
+/* Number of free map file sectors written. */
+static long long sectors_written;
+
+static void mark_dirty (block_sector_t, size_t);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                               BITS_PER_SECTOR));
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
@@ -22,31 +44,109 @@ free_map_init (void)
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
+    mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates a run of up to CNT consecutive sectors from the free
+   map, preferring sectors at or after HINT, and stores the first
+   into *SECTORP.  Allocates fewer than CNT sectors only if no run
+   of CNT free sectors exists.
+   Returns the number of sectors allocated, or 0 if none were
+   free. */
+size_t
+free_map_allocate_run (size_t cnt, block_sector_t hint,
+                       block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (hint > bitmap_size (free_map))
+    hint = 0;
+  for (; cnt > 0; cnt /= 2) 
+    {
+      sector = bitmap_scan (free_map, hint, cnt, false);
+      if (sector == BITMAP_ERROR && hint != 0)
+        sector = bitmap_scan (free_map, 0, cnt, false);
+      if (sector != BITMAP_ERROR)
+        break;
+    }
+  if (sector != BITMAP_ERROR) 
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      mark_dirty (sector, cnt);
+    }
+  lock_release (&free_map_lock);
+  if (cnt > 0)
+    *sectorp = sector;
+  return cnt;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that have changed
+   since they were last written. */
+void
+free_map_sync (void) 
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_sectors); i++)
+      if (bitmap_test (dirty_sectors, i)) 
+        {
+          size_t start = i * BITS_PER_SECTOR;
+          size_t cnt = bitmap_size (free_map) - start;
+          if (cnt > BITS_PER_SECTOR)
+            cnt = BITS_PER_SECTOR;
+          if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+            PANIC ("can't write free map");
+          bitmap_reset (dirty_sectors, i);
+          sectors_written++;
+        }
+  lock_release (&free_map_lock);
+}
+
+/* Prints free map statistics. */
+void
+free_map_print_stats (void) 
+{
+  printf ("Free map: %lld sectors written\n", sectors_written);
+}
+
+/* Marks the free map file sectors that hold the bits for the CNT
+   sectors starting at SECTOR as dirty.  free_map_lock must be
+   held. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt) 
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -64,6 +164,7 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  free_map_sync ();
   file_close (free_map_file);
 }
 
@@ -82,4 +183,7 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_sectors, false);
+  sectors_written += DIV_ROUND_UP (bitmap_file_size (free_map),
+                                   BLOCK_SECTOR_SIZE);
 }
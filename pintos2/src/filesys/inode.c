@@ -1,23 +1,48 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sector pointers in an index block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Number of direct pointers in an on-disk inode. */
+#define DIRECT_CNT 124
+
+/* Sector indexes, within a file, at which the singly and doubly
+   indirect blocks take over, and the number of sectors a file
+   can have. */
+#define INDIRECT_START DIRECT_CNT
+#define DOUBLY_START (INDIRECT_START + PTRS_PER_SECTOR)
+#define MAX_SECTORS (DOUBLY_START + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The first DIRECT_CNT data sectors are listed in `direct'.  The
+   next PTRS_PER_SECTOR are listed in the index block `indirect',
+   and the rest in the index blocks listed in the index block
+   `doubly_indirect'.  Every sector up to the end of the file is
+   allocated, and index blocks exist exactly as far as needed to
+   list them. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Singly indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,17 +53,122 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   The hash and list elements, open count and removed flag are
+   protected by open_inodes_lock.  The rest is protected by the
+   inode's own readers-writer lock: reads of the file's data
+   share it, and writes hold it exclusively. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in `open_inodes'. */
+    struct list_elem lru_elem;          /* Element in `closed_inodes'. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    struct rwlock rwlock;               /* Protects the members below. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
   };
 
+static bool extend (struct inode_disk *, block_sector_t inode_sector,
+                    off_t length, off_t keep_ofs, off_t keep_end);
+static void release_sectors (struct inode_disk *, size_t from, size_t to);
+
+/* Returns entry IDX in index block SECTOR. */
+static block_sector_t
+index_get (block_sector_t sector, size_t idx) 
+{
+  block_sector_t entry;
+  cache_read_at (sector, &entry, idx * sizeof entry, sizeof entry);
+  return entry;
+}
+
+/* Sets entry IDX in index block SECTOR to ENTRY. */
+static void
+index_set (block_sector_t sector, size_t idx, block_sector_t entry) 
+{
+  cache_write_at (sector, &entry, idx * sizeof entry, sizeof entry);
+}
+
+/* Allocates an index block with all entries zero and stores
+   its sector into *SECTORP.  Returns true if successful. */
+static bool
+index_create (block_sector_t *sectorp) 
+{
+  static block_sector_t zeros[PTRS_PER_SECTOR];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns the sector that holds sector IDX of the file whose
+   on-disk inode is DISK_INODE.  Sector IDX must be allocated.
+   Costs at most two cached reads of index blocks. */
+static block_sector_t
+lookup (const struct inode_disk *disk_inode, size_t idx) 
+{
+  ASSERT (idx < MAX_SECTORS);
+
+  if (idx < INDIRECT_START)
+    return disk_inode->direct[idx];
+  else if (idx < DOUBLY_START)
+    return index_get (disk_inode->indirect, idx - INDIRECT_START);
+  else 
+    {
+      idx -= DOUBLY_START;
+      return index_get (index_get (disk_inode->doubly_indirect,
+                                   idx / PTRS_PER_SECTOR),
+                        idx % PTRS_PER_SECTOR);
+    }
+}
+
+/* Records SECTOR as sector IDX of the file whose on-disk inode is
+   DISK_INODE, creating index blocks as needed.  Sectors 0 through
+   IDX - 1 must already be recorded.  Returns true if successful,
+   false if an index block could not be allocated. */
+static bool
+record (struct inode_disk *disk_inode, size_t idx, block_sector_t sector) 
+{
+  ASSERT (idx < MAX_SECTORS);
+
+  if (idx < INDIRECT_START)
+    disk_inode->direct[idx] = sector;
+  else if (idx < DOUBLY_START) 
+    {
+      idx -= INDIRECT_START;
+      if (idx == 0 && !index_create (&disk_inode->indirect))
+        return false;
+      index_set (disk_inode->indirect, idx, sector);
+    }
+  else 
+    {
+      block_sector_t level2;
+
+      idx -= DOUBLY_START;
+      if (idx == 0 && !index_create (&disk_inode->doubly_indirect))
+        return false;
+      if (idx % PTRS_PER_SECTOR == 0) 
+        {
+          if (!index_create (&level2))
+            {
+              if (idx == 0)
+                free_map_release (disk_inode->doubly_indirect, 1);
+              return false;
+            }
+          index_set (disk_inode->doubly_indirect, idx / PTRS_PER_SECTOR,
+                     level2);
+        }
+      else
+        level2 = index_get (disk_inode->doubly_indirect,
+                            idx / PTRS_PER_SECTOR);
+      index_set (level2, idx % PTRS_PER_SECTOR, sector);
+    }
+  return true;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
@@ -48,20 +178,49 @@ byte_to_sector (const struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return lookup (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Maximum number of closed inodes kept in memory. */
+#define CLOSED_INODES_MAX 16
+
+/* In-memory inodes, by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Besides the open
+   inodes, holds the CLOSED_INODES_MAX most recently closed ones,
+   so that reopening one, as exec does for a program run over and
+   over, does not read its sector again. */
+static struct hash open_inodes;
+
+/* Closed inodes in `open_inodes', least recently closed first. */
+static struct list closed_inodes;
+static size_t closed_inode_cnt;
+
+/* Protects open_inodes, closed_inodes, and the open count and
+   removed flag of each inode in them. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static struct inode *find_inode (block_sector_t);
+static void forget_closed_inode (struct inode *);
+
+/* Cache of in-memory inodes.  Its constructor initializes each
+   inode's lock, which is always released by the time the inode
+   is freed. */
+static struct slab_cache inode_cache;
+static slab_ctor_func inode_ctor;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate open inode table");
+  list_init (&closed_inodes);
+  lock_init (&open_inodes_lock);
+  slab_cache_init (&inode_cache, "inode", sizeof (struct inode), inode_ctor);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -73,6 +232,7 @@ bool
 inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
+  struct inode *stale;
   bool success = false;
 
   ASSERT (length >= 0);
@@ -81,23 +241,22 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  /* Forget any closed inode that used to be in SECTOR. */
+  lock_acquire (&open_inodes_lock);
+  stale = find_inode (sector);
+  if (stale != NULL)
+    forget_closed_inode (stale);
+  lock_release (&open_inodes_lock);
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
+      disk_inode->length = 0;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (extend (disk_inode, sector, length, 0, 0)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          disk_inode->length = length;
+          cache_write (sector, disk_inode);
           success = true; 
         } 
       free (disk_inode);
@@ -111,33 +270,40 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+
+  /* Check whether this inode is already in memory. */
+  inode = find_inode (sector);
+  if (inode != NULL) 
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt++ == 0) 
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->lru_elem);
+          closed_inode_cnt--;
         }
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+  inode = slab_alloc (&inode_cache);
+  if (inode == NULL) 
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read in before it is published, so
+     that a concurrent opener never sees it half-initialized. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  cache_read (inode->sector, &inode->data);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -145,8 +311,12 @@ inode_open (block_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  if (inode != NULL)
-    inode->open_cnt++;
+  if (inode != NULL) 
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -157,9 +327,12 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-/* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+/* Closes INODE.
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, freeing the least recently closed one
+   if there are too many.
+   If INODE was also a removed inode, frees its memory and its
+   blocks instead. */
 void
 inode_close (struct inode *inode) 
 {
@@ -168,42 +341,116 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt == 0 && !inode->removed) 
+    {
+      list_push_back (&closed_inodes, &inode->lru_elem);
+      if (++closed_inode_cnt > CLOSED_INODES_MAX)
+        forget_closed_inode (list_entry (list_front (&closed_inodes),
+                                         struct inode, lru_elem));
+      lock_release (&open_inodes_lock);
+    }
+  else if (inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_sectors (&inode->data, 0,
+                           bytes_to_sectors (inode->data.length));
         }
 
-      free (inode); 
+      slab_free (&inode_cache, inode);
+    }
+  else
+    lock_release (&open_inodes_lock);
+}
+
+/* Returns the in-memory inode for SECTOR, open or recently
+   closed, or a null pointer if there is none.
+   open_inodes_lock must be held. */
+static struct inode *
+find_inode (block_sector_t sector) 
+{
+  /* Too big for the stack, and open_inodes_lock serializes
+     its users anyway. */
+  static struct inode key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
+
+/* Drops INODE, if it is closed, from memory.
+   open_inodes_lock must be held. */
+static void
+forget_closed_inode (struct inode *inode) 
+{
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+
+  if (inode->open_cnt == 0) 
+    {
+      list_remove (&inode->lru_elem);
+      closed_inode_cnt--;
+      hash_delete (&open_inodes, &inode->elem);
+      slab_free (&inode_cache, inode);
     }
 }
 
+/* Constructs inode INODE_ for inode_cache. */
+static void
+inode_ctor (void *inode_) 
+{
+  struct inode *inode = inode_;
+  rwlock_init (&inode->rwlock);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED) 
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Any number of threads may read from an inode at once. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -220,50 +467,65 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      cache_read_at (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
+/* Starts reading the SIZE bytes of INODE at OFFSET into the
+   buffer cache in the background, stopping at end of file. */
+void
+inode_readahead (struct inode *inode, off_t size, off_t offset) 
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    cache_readahead (byte_to_sector (inode, offset));
+  rwlock_release_read (&inode->rwlock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or an error occurs.
+   A write past end of file extends the inode; any gap between
+   the old end of file and OFFSET reads as zeros.
+   Writers have exclusive access to the inode. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  rwlock_acquire_write (&inode->rwlock);
+  if (inode->deny_write_cnt) 
+    {
+      rwlock_release_write (&inode->rwlock);
+      return 0;
+    }
+
+  if (size > 0 && offset + size > inode->data.length) 
+    {
+      /* Grow the file.  Sectors this write covers entirely need
+         not be zeroed first. */
+      if (extend (&inode->data, inode->sector, offset + size,
+                  offset, offset + size)) 
+        {
+          inode->data.length = offset + size;
+          cache_write (inode->sector, &inode->data);
+        }
+    }
 
   while (size > 0) 
     {
@@ -281,38 +543,17 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The cache reads in the rest of the sector first if the
+         chunk does not cover all of it. */
+      cache_write_at (sector_idx, buffer + bytes_written,
+                      sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  rwlock_release_write (&inode->rwlock);
 
   return bytes_written;
 }
@@ -322,8 +563,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +575,109 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Allocates data sectors so that the file whose on-disk inode,
+   stored in INODE_SECTOR, is DISK_INODE can be LENGTH bytes
+   long.  Does not change DISK_INODE->length.  New sectors are
+   zeroed, except those that lie entirely within the byte range
+   KEEP_OFS...KEEP_END, which the caller is about to overwrite.
+
+   Sectors are allocated in runs of consecutive sectors as long
+   as possible, each run placed after the previous data sector
+   if there is room, so that sequential access stays fast.
+
+   Returns true if successful.  On failure, releases whatever
+   was allocated and returns false. */
+static bool
+extend (struct inode_disk *disk_inode, block_sector_t inode_sector,
+        off_t length, off_t keep_ofs, off_t keep_end) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t old_cnt = bytes_to_sectors (disk_inode->length);
+  size_t new_cnt = bytes_to_sectors (length);
+  size_t idx = old_cnt;
+
+  if (new_cnt > MAX_SECTORS)
+    return false;
+
+  while (idx < new_cnt) 
+    {
+      block_sector_t hint, first;
+      size_t run, i;
+
+      hint = idx > 0 ? lookup (disk_inode, idx - 1) + 1 : inode_sector + 1;
+      run = free_map_allocate_run (new_cnt - idx, hint, &first);
+      if (run == 0)
+        goto fail;
+
+      for (i = 0; i < run; i++, idx++) 
+        {
+          off_t sector_ofs = (off_t) idx * BLOCK_SECTOR_SIZE;
+
+          if (!record (disk_inode, idx, first + i)) 
+            {
+              free_map_release (first + i, run - i);
+              goto fail;
+            }
+          if (sector_ofs < keep_ofs || sector_ofs + BLOCK_SECTOR_SIZE > keep_end)
+            cache_write (first + i, zeros);
+        }
+    }
+  return true;
+
+ fail:
+  release_sectors (disk_inode, old_cnt, idx);
+  return false;
+}
+
+/* Releases data sectors FROM through TO - 1 of the file whose
+   on-disk inode is DISK_INODE, which must be exactly the file's
+   last allocated sectors, along with any index blocks that
+   listed only those sectors.  Consecutive sectors are returned
+   to the free map together. */
+static void
+release_sectors (struct inode_disk *disk_inode, size_t from, size_t to) 
+{
+  block_sector_t run_start = 0;
+  size_t run_cnt = 0;
+  size_t idx;
+
+  for (idx = from; idx < to; idx++) 
+    {
+      block_sector_t sector = lookup (disk_inode, idx);
+      if (run_cnt > 0 && sector == run_start + run_cnt)
+        run_cnt++;
+      else 
+        {
+          if (run_cnt > 0)
+            free_map_release (run_start, run_cnt);
+          run_start = sector;
+          run_cnt = 1;
+        }
+    }
+  if (run_cnt > 0)
+    free_map_release (run_start, run_cnt);
+
+  /* Index blocks. */
+  if (from <= INDIRECT_START && to > INDIRECT_START)
+    free_map_release (disk_inode->indirect, 1);
+  if (to > DOUBLY_START) 
+    {
+      size_t first = from > DOUBLY_START ? from - DOUBLY_START : 0;
+      size_t last = to - DOUBLY_START;
+
+      for (idx = DIV_ROUND_UP (first, PTRS_PER_SECTOR);
+           idx < DIV_ROUND_UP (last, PTRS_PER_SECTOR); idx++)
+        free_map_release (index_get (disk_inode->doubly_indirect, idx), 1);
+      if (first == 0)
+        free_map_release (disk_inode->doubly_indirect, 1);
+    }
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -28,6 +28,7 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    size_t next_fit;    /* Where bitmap_scan_and_flip_next() starts. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -68,6 +69,123 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a mask of the bits in an element at and above the one
+   that corresponds to BIT_IDX. */
+static inline elem_type
+low_cut (size_t bit_idx) 
+{
+  return (elem_type) -1 << (bit_idx % ELEM_BITS);
+}
+
+/* Returns a mask of the bits in an element below the one that
+   corresponds to END, or all of them if END is the first bit of
+   an element. */
+static inline elem_type
+high_cut (size_t end) 
+{
+  int bits = end % ELEM_BITS;
+  return bits ? ((elem_type) 1 << bits) - 1 : (elem_type) -1;
+}
+
+/* Returns element IDX of B, inverted if VALUE is false, so that
+   the bits that equal VALUE are 1.  Bits past the end of B are
+   0. */
+static inline elem_type
+elem_value (const struct bitmap *b, size_t idx, bool value) 
+{
+  elem_type e = value ? b->bits[idx] : ~b->bits[idx];
+  if (idx == elem_cnt (b->bit_cnt) - 1)
+    e &= last_mask (b);
+  return e;
+}
+
+/* Returns the index of the lowest 1 bit in E, which must not be
+   0.  See the description of the BSF instruction in
+   [IA32-v2a]. */
+static inline size_t
+bsf (elem_type e) 
+{
+  elem_type idx;
+  asm ("bsfl %1, %0" : "=r" (idx) : "rm" (e) : "cc");
+  return idx;
+}
+
+/* Returns the index of the highest 1 bit in E, which must not be
+   0.  See the description of the BSR instruction in
+   [IA32-v2a]. */
+static inline size_t
+bsr (elem_type e) 
+{
+  elem_type idx;
+  asm ("bsrl %1, %0" : "=r" (idx) : "rm" (e) : "cc");
+  return idx;
+}
+
+/* Returns the number of 1 bits in E.  The 80386 has no POPCNT
+   instruction, so this adds up bits in parallel within E. */
+static inline size_t
+popcount (elem_type e) 
+{
+  e = e - ((e >> 1) & 0x55555555);
+  e = (e & 0x33333333) + ((e >> 2) & 0x33333333);
+  e = (e + (e >> 4)) & 0x0f0f0f0f;
+  return (e * 0x01010101) >> 24;
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Skips whole elements that contain no such bit. */
+static size_t
+find_first (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  size_t idx, last_idx;
+  elem_type e;
+
+  if (start >= end)
+    return end;
+
+  idx = elem_idx (start);
+  last_idx = elem_idx (end - 1);
+  e = elem_value (b, idx, value) & low_cut (start);
+  for (;;) 
+    {
+      if (idx == last_idx)
+        e &= high_cut (end);
+      if (e != 0)
+        return idx * ELEM_BITS + bsf (e);
+      if (idx == last_idx)
+        return end;
+      e = elem_value (b, ++idx, value);
+    }
+}
+
+/* Returns the index of the last bit in B between START and END,
+   exclusive, that is set to VALUE, or BITMAP_ERROR if there is
+   none.  Skips whole elements that contain no such bit. */
+static size_t
+find_last (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  size_t idx, first_idx;
+  elem_type e;
+
+  if (start >= end)
+    return BITMAP_ERROR;
+
+  idx = elem_idx (end - 1);
+  first_idx = elem_idx (start);
+  e = elem_value (b, idx, value) & high_cut (end);
+  for (;;) 
+    {
+      if (idx == first_idx)
+        e &= low_cut (start);
+      if (e != 0)
+        return idx * ELEM_BITS + bsr (e);
+      if (idx == first_idx)
+        return BITMAP_ERROR;
+      e = elem_value (b, --idx, value);
+    }
+}
 
 /* Creation and destruction. */
 
@@ -82,6 +200,7 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->next_fit = 0;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -104,6 +223,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->next_fit = 0;
   b->bits = (elem_type *) (b + 1);
   bitmap_set_all (b, false);
   return b;
@@ -213,18 +333,37 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Whole elements are stored directly; the bits of a partial
+   element at either end are set atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t idx, last_idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+
+  last_idx = elem_idx (start + cnt - 1);
+  for (idx = elem_idx (start); idx <= last_idx; idx++) 
+    {
+      elem_type mask = (elem_type) -1;
+      if (idx == elem_idx (start))
+        mask &= low_cut (start);
+      if (idx == last_idx)
+        mask &= high_cut (start + cnt);
+
+      if (mask == (elem_type) -1)
+        b->bits[idx] = value ? (elem_type) -1 : 0;
+      else if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,16 +371,26 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t idx, last_idx, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
+  if (cnt == 0)
+    return 0;
+
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  last_idx = elem_idx (start + cnt - 1);
+  for (idx = elem_idx (start); idx <= last_idx; idx++) 
+    {
+      elem_type e = elem_value (b, idx, value);
+      if (idx == elem_idx (start))
+        e &= low_cut (start);
+      if (idx == last_idx)
+        e &= high_cut (start + cnt);
+      value_cnt += popcount (e);
+    }
   return value_cnt;
 }
 
@@ -250,16 +399,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_first (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -291,7 +435,12 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Candidate groups start only at bits set to VALUE.  When a
+   candidate contains a bit set to !VALUE, the search resumes
+   just past the last such bit in it, since no group that
+   includes that bit can succeed. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
@@ -301,10 +450,22 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (cnt == 0)
+        return i <= last ? i : BITMAP_ERROR;
+      while (i <= last) 
+        {
+          size_t conflict;
+
+          i = find_first (b, i, last + 1, value);
+          if (i > last)
+            break;
+          conflict = find_last (b, i, i + cnt, !value);
+          if (conflict == BITMAP_ERROR)
+            return i;
+          i = conflict + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -324,6 +485,31 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but searches next-fit: starts
+   just past the group found by the previous call, wrapping
+   around to the start of B if need be.  This spreads successive
+   allocations through B instead of rescanning its busy front
+   every time. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value) 
+{
+  size_t idx;
+
+  ASSERT (b != NULL);
+
+  if (b->next_fit > b->bit_cnt)
+    b->next_fit = 0;
+  idx = bitmap_scan (b, b->next_fit, cnt, value);
+  if (idx == BITMAP_ERROR && b->next_fit > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR) 
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->next_fit = idx + cnt;
+    }
+  return idx;
+}
 
 /* File input and output. */
 
@@ -358,6 +544,24 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at
+   START to FILE, rounded out to whole bytes.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+  return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,189 @@
+#include "lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* Compressed data is a series of sequences.  Each one is a token
+   byte, whose high nibble is a count of literal bytes and whose
+   low nibble is a match length less LZ_MIN_MATCH, followed by the
+   literals, then the match offset as 2 bytes little-endian.  A
+   nibble of 15 means the count continues in the bytes after the
+   token (for literals) or the offset (for the match): each adds
+   its value, and a byte below 255 ends it.  The last sequence has
+   no match: the data ends right after its literals. */
+
+/* Shortest match worth encoding. */
+#define LZ_MIN_MATCH 4
+
+/* Farthest back a match can start. */
+#define LZ_MAX_OFFSET 65535
+
+/* The compressor finds matches through a hash table of the last
+   position at which each hash of 4 bytes was seen. */
+#define HASH_BITS 10
+#define HASH_CNT (1 << HASH_BITS)
+
+static unsigned
+hash4 (const uint8_t *p) 
+{
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends LEN as the continuation of a count to OUT. */
+static uint8_t *
+put_length (uint8_t *out, size_t len) 
+{
+  for (; len >= 255; len -= 255)
+    *out++ = 255;
+  *out++ = len;
+  return out;
+}
+
+/* Appends a sequence of the LIT_CNT literals at LIT, then a match
+   of MATCH_LEN bytes at OFFSET back, to *OUT, which must not pass
+   OUT_END.  A MATCH_LEN of 0 makes the last sequence.
+   Returns false if the sequence does not fit. */
+static bool
+put_sequence (uint8_t **out, const uint8_t *out_end, const uint8_t *lit,
+              size_t lit_cnt, size_t offset, size_t match_len) 
+{
+  size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+  size_t max_size = 1 + lit_cnt / 255 + 1 + lit_cnt + 2 + match_code / 255 + 1;
+  uint8_t *p = *out;
+  uint8_t *token;
+
+  if ((size_t) (out_end - p) < max_size)
+    return false;
+
+  token = p++;
+  *token = (lit_cnt < 15 ? lit_cnt : 15) << 4;
+  if (lit_cnt >= 15)
+    p = put_length (p, lit_cnt - 15);
+  memcpy (p, lit, lit_cnt);
+  p += lit_cnt;
+
+  if (match_len > 0) 
+    {
+      *token |= match_code < 15 ? match_code : 15;
+      *p++ = offset & 0xff;
+      *p++ = offset >> 8;
+      if (match_code >= 15)
+        p = put_length (p, match_code - 15);
+    }
+
+  *out = p;
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC into the DST_SIZE bytes
+   at DST, using LZ_WORK_SIZE bytes of scratch memory at WORK.
+   SRC_SIZE must not exceed LZ_MAX_INPUT.
+   Returns the size of the compressed data, or 0 if it would not
+   fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src, size_t src_size,
+             void *dst, size_t dst_size, void *work) 
+{
+  const uint8_t *in = src;
+  uint8_t *out = dst;
+  const uint8_t *out_end = out + dst_size;
+  uint16_t *table = work;
+  size_t anchor = 0;
+  size_t pos = 0;
+
+  ASSERT (src_size <= LZ_MAX_INPUT);
+
+  memset (table, 0, LZ_WORK_SIZE);
+  while (pos + LZ_MIN_MATCH <= src_size) 
+    {
+      unsigned h = hash4 (in + pos);
+      size_t cand = table[h];
+
+      table[h] = pos;
+      if (cand < pos && pos - cand <= LZ_MAX_OFFSET
+          && !memcmp (in + cand, in + pos, LZ_MIN_MATCH)) 
+        {
+          size_t len = LZ_MIN_MATCH;
+
+          while (pos + len < src_size && in[cand + len] == in[pos + len])
+            len++;
+          if (!put_sequence (&out, out_end, in + anchor, pos - anchor,
+                             pos - cand, len))
+            return 0;
+          pos += len;
+          anchor = pos;
+        }
+      else
+        pos++;
+    }
+
+  if (!put_sequence (&out, out_end, in + anchor, src_size - anchor, 0, 0))
+    return 0;
+  return out - (uint8_t *) dst;
+}
+
+/* Reads the continuation of a count from *IN, which must not
+   pass IN_END, and adds it to *LEN.  Returns false if the data
+   ends first. */
+static bool
+get_length (const uint8_t **in, const uint8_t *in_end, size_t *len) 
+{
+  uint8_t b;
+
+  do
+    {
+      if (*in >= in_end)
+        return false;
+      b = *(*in)++;
+      *len += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+/* Decompresses the SRC_SIZE bytes of compressed data at SRC into
+   the DST_SIZE bytes at DST.  Returns true if the data is valid
+   and decompresses to exactly DST_SIZE bytes. */
+bool
+lz_decompress (const void *src, size_t src_size, void *dst, size_t dst_size) 
+{
+  const uint8_t *in = src;
+  const uint8_t *in_end = in + src_size;
+  uint8_t *out = dst;
+  uint8_t *out_end = out + dst_size;
+
+  while (in < in_end) 
+    {
+      uint8_t token = *in++;
+      size_t lit_cnt = token >> 4;
+      size_t match_len = token & 15;
+      size_t offset;
+      const uint8_t *match;
+
+      if (lit_cnt == 15 && !get_length (&in, in_end, &lit_cnt))
+        return false;
+      if (lit_cnt > (size_t) (in_end - in) || lit_cnt > (size_t) (out_end - out))
+        return false;
+      memcpy (out, in, lit_cnt);
+      in += lit_cnt;
+      out += lit_cnt;
+      if (in == in_end)
+        break;
+
+      if (in_end - in < 2)
+        return false;
+      offset = in[0] | (in[1] << 8);
+      in += 2;
+      if (match_len == 15 && !get_length (&in, in_end, &match_len))
+        return false;
+      match_len += LZ_MIN_MATCH;
+      if (offset == 0 || offset > (size_t) (out - (uint8_t *) dst)
+          || match_len > (size_t) (out_end - out))
+        return false;
+
+      /* Byte by byte: the match may overlap the output. */
+      for (match = out - offset; match_len > 0; match_len--)
+        *out++ = *match++;
+    }
+  return out == out_end;
+}
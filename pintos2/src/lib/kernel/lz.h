@@ -0,0 +1,23 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* LZ77-style compression, in the byte-oriented format of LZ4.
+   Fast rather than thorough: meant for compressing pages of
+   memory on the fly. */
+
+/* Bytes of scratch memory lz_compress() needs. */
+#define LZ_WORK_SIZE (1024 * sizeof (uint16_t))
+
+/* Largest input lz_compress() accepts. */
+#define LZ_MAX_INPUT 65535
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, void *work);
+bool lz_decompress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
@@ -0,0 +1,61 @@
+/* Creates, looks up and removes many files in the root
+   directory, which must grow well past its initial size.  With
+   the directory index, the lookups should cost the same number
+   of disk reads no matter how many files there are; compare the
+   sector counts printed at power-off for different FILE_CNTs. */
+
+#include <syscall.h>
+#include <stdio.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 300
+
+static void
+file_name (char *name, size_t size, int i) 
+{
+  snprintf (name, size, "many%d", i);
+}
+
+void
+test_main (void) 
+{
+  char name[16];
+  int i;
+
+  msg ("creating %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      file_name (name, sizeof name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  msg ("looking up %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      int fd;
+
+      file_name (name, sizeof name, i);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\"", name);
+      close (fd);
+    }
+
+  msg ("removing %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      file_name (name, sizeof name, i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+
+  msg ("checking that the files are gone");
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      file_name (name, sizeof name, i);
+      if (open (name) != -1)
+        fail ("open \"%s\" succeeded after remove", name);
+    }
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-many) begin
+(dir-many) creating 300 files
+(dir-many) looking up 300 files
+(dir-many) removing 300 files
+(dir-many) checking that the files are gone
+(dir-many) end
+EOF
+pass;
@@ -0,0 +1,242 @@
+/* Test program and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_count(), bitmap_contains() and bitmap_scan()
+   against straightforward bit-at-a-time versions, like the ones
+   they replaced, on random bitmaps, checks the next-fit hint
+   kept by bitmap_scan_and_flip_next(), then times both versions
+   on a 1M-bit map.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in the benchmark bitmap. */
+#define BENCH_BITS (1024 * 1024)
+
+/* Number of bits in the next-fit bitmap, and the size of each
+   group allocated from it. */
+#define NEXT_BITS 64
+#define NEXT_CNT 4
+
+static size_t old_count (const struct bitmap *, size_t start, size_t cnt,
+                         bool);
+static bool old_contains (const struct bitmap *, size_t start, size_t cnt,
+                          bool);
+static size_t old_scan (const struct bitmap *, size_t start, size_t cnt,
+                        bool);
+static void randomize (struct bitmap *, int density);
+static void verify (void);
+static void verify_next_fit (void);
+static void benchmark (void);
+
+/* Test the bitmap implementation. */
+void
+test (void) 
+{
+  verify ();
+  verify_next_fit ();
+  benchmark ();
+  printf ("bitmap: PASS\n");
+}
+
+/* Compares the bitmap functions with the old versions on many
+   random bitmaps of various sizes and densities. */
+static void
+verify (void) 
+{
+  size_t size;
+
+  printf ("testing various size bitmaps:");
+  for (size = 1; size < 200; size += 7) 
+    {
+      struct bitmap *b = bitmap_create (size);
+      int density;
+
+      ASSERT (b != NULL);
+      printf (" %zu", size);
+      for (density = 0; density <= 100; density += 10) 
+        {
+          int repeat;
+
+          for (repeat = 0; repeat < 10; repeat++) 
+            {
+              size_t start = random_ulong () % (size + 1);
+              size_t cnt = random_ulong () % (size - start + 1);
+              bool value = random_ulong () % 2;
+
+              randomize (b, density);
+              ASSERT (bitmap_count (b, start, cnt, value)
+                      == old_count (b, start, cnt, value));
+              ASSERT (bitmap_contains (b, start, cnt, value)
+                      == old_contains (b, start, cnt, value));
+              ASSERT (bitmap_scan (b, start, cnt, value)
+                      == old_scan (b, start, cnt, value));
+              cnt = random_ulong () % 8 + 1;
+              ASSERT (bitmap_scan (b, start, cnt, value)
+                      == old_scan (b, start, cnt, value));
+
+              cnt = random_ulong () % (size - start + 1);
+              bitmap_set_multiple (b, start, cnt, value);
+              ASSERT (old_count (b, start, cnt, value) == cnt);
+            }
+        }
+      bitmap_destroy (b);
+    }
+  printf (" done\n");
+}
+
+/* Allocates groups of NEXT_CNT bits from a NEXT_BITS-bit map
+   with bitmap_scan_and_flip_next(), frees some of them behind
+   and ahead of the next-fit hint, and checks that each call
+   returns the group that a next-fit search from the hint, with
+   wraparound, should find. */
+static void
+verify_next_fit (void) 
+{
+  struct bitmap *b = bitmap_create (NEXT_BITS);
+  size_t i;
+
+  ASSERT (b != NULL);
+  printf ("testing next-fit allocation:");
+
+  /* Successive groups are handed out in order from the front. */
+  for (i = 0; i < NEXT_BITS; i += NEXT_CNT)
+    ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == i);
+  ASSERT (bitmap_all (b, 0, NEXT_BITS));
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == BITMAP_ERROR);
+  printf (" fill");
+
+  /* The hint is at the end of the map, so groups freed behind it
+     are found by wrapping around, lowest first. */
+  bitmap_set_multiple (b, 8, NEXT_CNT, false);
+  bitmap_set_multiple (b, 0, NEXT_CNT, false);
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == 0);
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == 8);
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == BITMAP_ERROR);
+  printf (" wrap");
+
+  /* The hint is now at bit 12.  A group freed ahead of it is
+     taken before one freed behind it, even though the one behind
+     comes first in the map. */
+  bitmap_set_multiple (b, 4, NEXT_CNT, false);
+  bitmap_set_multiple (b, 40, NEXT_CNT, false);
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == 40);
+  ASSERT (bitmap_test (b, 4) == false);
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == 4);
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == BITMAP_ERROR);
+  printf (" skip");
+
+  /* The hint is now at bit 8.  A free run that straddles it is
+     too short when scanned from the hint, so only the full scan
+     from bit 0 finds it. */
+  bitmap_set_multiple (b, 6, NEXT_CNT, false);
+  ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == 6);
+  ASSERT (bitmap_all (b, 0, NEXT_BITS));
+  printf (" straddle");
+
+  /* A lone free group anywhere in the map is always found. */
+  for (i = 0; i < NEXT_BITS; i += NEXT_CNT) 
+    {
+      bitmap_set_multiple (b, i, NEXT_CNT, false);
+      ASSERT (bitmap_scan_and_flip_next (b, NEXT_CNT, false) == i);
+      ASSERT (bitmap_all (b, 0, NEXT_BITS));
+    }
+  printf (" single");
+
+  bitmap_destroy (b);
+  printf (" done\n");
+}
+
+/* Times the old and new bitmap functions on a 1M-bit map that is
+   nearly full, as a well-used free map or swap map would be. */
+static void
+benchmark (void) 
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  int64_t start;
+  size_t old_idx, new_idx;
+
+  ASSERT (b != NULL);
+  randomize (b, 99);
+  bitmap_set_multiple (b, BENCH_BITS - 64, 16, false);
+
+  start = timer_ticks ();
+  old_idx = old_scan (b, 0, 16, false);
+  printf ("old scan for 16 free bits: %"PRId64" ticks\n",
+          timer_elapsed (start));
+  start = timer_ticks ();
+  new_idx = bitmap_scan (b, 0, 16, false);
+  printf ("new scan for 16 free bits: %"PRId64" ticks\n",
+          timer_elapsed (start));
+  ASSERT (old_idx == new_idx);
+
+  start = timer_ticks ();
+  old_idx = old_count (b, 0, BENCH_BITS, true);
+  printf ("old count: %"PRId64" ticks\n", timer_elapsed (start));
+  start = timer_ticks ();
+  new_idx = bitmap_count (b, 0, BENCH_BITS, true);
+  printf ("new count: %"PRId64" ticks\n", timer_elapsed (start));
+  ASSERT (old_idx == new_idx);
+
+  bitmap_destroy (b);
+}
+
+/* Sets each bit in B to true with probability DENSITY percent. */
+static void
+randomize (struct bitmap *b, int density) 
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < density);
+}
+
+/* Returns the number of bits in B between START and START + CNT,
+   exclusive, that are set to VALUE, one bit at a time. */
+static size_t
+old_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Returns true if any bits in B between START and START + CNT,
+   exclusive, are set to VALUE, one bit at a time. */
+static bool
+old_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+/* Finds the first group of CNT consecutive bits in B at or after
+   START that are all set to VALUE, trying every starting bit. */
+static size_t
+old_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  if (cnt <= bitmap_size (b)) 
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!old_contains (b, i, cnt, !value))
+          return i; 
+    }
+  return BITMAP_ERROR;
+}
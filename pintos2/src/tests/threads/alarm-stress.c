@@ -0,0 +1,160 @@
+/* Arms thousands of alarms at once, with deadlines spread over
+   every level of the timer's timing wheel, while a few dozen
+   threads sleep repeatedly for random durations.  A quarter of
+   the alarms are cancelled and another quarter are moved to a
+   new deadline before they go off.  Verifies that every
+   remaining alarm goes off exactly once, on its deadline, and
+   that no sleeping thread wakes up early. */
+
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ALARM_CNT 4096          /* Number of alarms. */
+#define SLEEPER_CNT 32          /* Number of sleeping threads. */
+#define SLEEP_CNT 8             /* Sleeps per thread. */
+
+/* One alarm under test. */
+struct stress_alarm 
+  {
+    struct alarm alarm;         /* The alarm. */
+    int64_t when;               /* Expected deadline. */
+    int fired;                  /* Number of times it went off. */
+  };
+
+/* Shared state, updated from the timer interrupt. */
+static int fired_cnt;           /* Alarms that went off. */
+static int wrong_cnt;           /* Alarms that went off on the wrong tick. */
+static int expected_cnt;        /* Alarms expected to go off. */
+static struct semaphore alarms_done;
+
+static struct semaphore sleepers_done;
+static int early_cnt;           /* Sleepers that woke up early. */
+
+static alarm_func stress_alarm_func;
+static thread_func sleeper;
+
+void
+test_alarm_stress (void) 
+{
+  struct stress_alarm *alarms;
+  int64_t start;
+  int twice_cnt;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  alarms = malloc (sizeof *alarms * ALARM_CNT);
+  if (alarms == NULL)
+    PANIC ("couldn't allocate alarms");
+
+  sema_init (&alarms_done, 0);
+  sema_init (&sleepers_done, 0);
+  fired_cnt = wrong_cnt = early_cnt = 0;
+
+  msg ("Starting %d sleeping threads.", SLEEPER_CNT);
+  for (i = 0; i < SLEEPER_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "sleeper %d", i);
+      thread_create (name, PRI_DEFAULT, sleeper, NULL);
+    }
+
+  msg ("Arming %d alarms.", ALARM_CNT);
+  start = timer_ticks ();
+  for (i = 0; i < ALARM_CNT; i++) 
+    {
+      struct stress_alarm *a = &alarms[i];
+
+      /* Mostly short deadlines, with some reaching into the
+         upper levels of the wheel and beyond its span. */
+      if (i % 64 == 0)
+        a->when = start + 100 + random_ulong () % (1 << 26);
+      else if (i % 8 == 0)
+        a->when = start + 100 + random_ulong () % 20000;
+      else
+        a->when = start + 100 + random_ulong () % 1000;
+      a->fired = 0;
+      alarm_init (&a->alarm, stress_alarm_func, a);
+      alarm_arm (&a->alarm, a->when);
+    }
+
+  /* Cancel every alarm past the first deadline, so the test
+     doesn't take forever, plus a quarter of the rest. */
+  msg ("Cancelling and moving alarms.");
+  expected_cnt = ALARM_CNT;
+  for (i = 0; i < ALARM_CNT; i++) 
+    {
+      struct stress_alarm *a = &alarms[i];
+
+      if (a->when > start + 1100 || i % 4 == 1)
+        {
+          if (!alarm_cancel (&a->alarm))
+            fail ("alarm %d was not pending when cancelled", i);
+          expected_cnt--;
+        }
+      else if (i % 4 == 2)
+        {
+          a->when = start + 100 + random_ulong () % 1000;
+          alarm_arm (&a->alarm, a->when);
+        }
+    }
+  msg ("Waiting for alarms.");
+  sema_down (&alarms_done);
+
+  /* Cancelled alarms must not have gone off, the others exactly
+     once. */
+  twice_cnt = 0;
+  for (i = 0; i < ALARM_CNT; i++)
+    if (alarms[i].fired > 1 || alarm_pending (&alarms[i].alarm))
+      twice_cnt++;
+
+  msg ("Waiting for sleepers.");
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&sleepers_done);
+
+  msg ("%d alarms went off on the wrong tick.", wrong_cnt);
+  msg ("%d alarms went off more than once.", twice_cnt);
+  msg ("%d sleepers woke up early.", early_cnt);
+  if (fired_cnt != expected_cnt)
+    fail ("%d alarms went off, expected %d", fired_cnt, expected_cnt);
+  free (alarms);
+}
+
+/* Runs from the timer interrupt when alarm A_ goes off. */
+static void
+stress_alarm_func (void *a_) 
+{
+  struct stress_alarm *a = a_;
+
+  if (timer_ticks () != a->when)
+    wrong_cnt++;
+  a->fired++;
+  if (++fired_cnt == expected_cnt)
+    sema_up (&alarms_done);
+}
+
+/* Sleeps SLEEP_CNT times for random durations, checking that
+   each sleep lasted at least as long as requested. */
+static void
+sleeper (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < SLEEP_CNT; i++) 
+    {
+      int64_t duration = 1 + random_ulong () % 50;
+      int64_t start = timer_ticks ();
+
+      timer_sleep (duration);
+      if (timer_elapsed (start) < duration)
+        early_cnt++;
+    }
+  sema_up (&sleepers_done);
+}
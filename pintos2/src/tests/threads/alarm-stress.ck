@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-stress) begin
+(alarm-stress) Starting 32 sleeping threads.
+(alarm-stress) Arming 4096 alarms.
+(alarm-stress) Cancelling and moving alarms.
+(alarm-stress) Waiting for alarms.
+(alarm-stress) Waiting for sleepers.
+(alarm-stress) 0 alarms went off on the wrong tick.
+(alarm-stress) 0 alarms went off more than once.
+(alarm-stress) 0 sleepers woke up early.
+(alarm-stress) end
+EOF
+pass;
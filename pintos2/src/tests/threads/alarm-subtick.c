@@ -0,0 +1,67 @@
+/* Sleeps for a range of durations shorter than one timer tick
+   with timer_usleep() and checks against timer_ns() that each
+   sleep lasted at least as long as requested.  Meanwhile a
+   second thread checks, each time it gets to run, whether the
+   sleeper is blocked.  Time-slice preemption lets it run even
+   if the sleeps busy-wait, but it only ever finds the sleeper
+   blocked if they really block. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func counter;
+static struct thread *sleeper;
+static volatile bool done;
+static volatile int blocked_cnt;
+
+void
+test_alarm_subtick (void) 
+{
+  static const int64_t durations[] = {50, 200, 1000, 5000};
+  struct semaphore counter_done;
+  size_t i;
+  int j, short_cnt;
+
+  sema_init (&counter_done, 0);
+  sleeper = thread_current ();
+  done = false;
+  blocked_cnt = 0;
+  thread_create ("counter", PRI_DEFAULT, counter, &counter_done);
+
+  short_cnt = 0;
+  for (i = 0; i < sizeof durations / sizeof *durations; i++) 
+    for (j = 0; j < 10; j++) 
+      {
+        int64_t start = timer_ns ();
+        timer_usleep (durations[i]);
+        if (timer_ns () - start < durations[i] * 1000)
+          short_cnt++;
+      }
+
+  done = true;
+  sema_down (&counter_done);
+
+  msg ("%d sleeps were too short.", short_cnt);
+  msg ("Other thread %s us blocked.",
+       blocked_cnt > 0 ? "found" : "never found");
+}
+
+/* Yields repeatedly, counting the times it finds the sleeper
+   blocked, until the test is done. */
+static void
+counter (void *done_) 
+{
+  struct semaphore *counter_done = done_;
+
+  while (!done) 
+    {
+      if (sleeper->status == THREAD_BLOCKED)
+        blocked_cnt++;
+      thread_yield ();
+    }
+  sema_up (counter_done);
+}
@@ -0,0 +1,82 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point arithmetic, for the scheduler's
+   load average and recent_cpu estimates.  The kernel does not
+   support floating point.
+
+   A fixed-point number X represents the real number X / FP_ONE,
+   so it has 17 bits before the binary point and 14 after.
+   Products and quotients of two fixed-point numbers are formed
+   in 64 bits so that the intermediate result doesn't overflow. */
+typedef int fixed_point;
+
+#define FP_FRACTION_BITS 14
+#define FP_ONE (1 << FP_FRACTION_BITS)
+
+/* Returns integer N as a fixed-point number. */
+static inline fixed_point
+fp_from_int (int n) 
+{
+  return n * FP_ONE;
+}
+
+/* Returns X rounded toward zero to an integer. */
+static inline int
+fp_to_int (fixed_point x) 
+{
+  return x / FP_ONE;
+}
+
+/* Returns X rounded to the nearest integer. */
+static inline int
+fp_round (fixed_point x) 
+{
+  return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+
+/* Returns X + N, for integer N. */
+static inline fixed_point
+fp_add_int (fixed_point x, int n) 
+{
+  return x + n * FP_ONE;
+}
+
+/* Returns X - N, for integer N. */
+static inline fixed_point
+fp_sub_int (fixed_point x, int n) 
+{
+  return x - n * FP_ONE;
+}
+
+/* Returns X * Y. */
+static inline fixed_point
+fp_mul (fixed_point x, fixed_point y) 
+{
+  return (int64_t) x * y / FP_ONE;
+}
+
+/* Returns X / Y. */
+static inline fixed_point
+fp_div (fixed_point x, fixed_point y) 
+{
+  return (int64_t) x * FP_ONE / y;
+}
+
+/* Returns X * N, for integer N. */
+static inline fixed_point
+fp_mul_int (fixed_point x, int n) 
+{
+  return x * n;
+}
+
+/* Returns X / N, for integer N. */
+static inline fixed_point
+fp_div_int (fixed_point x, int n) 
+{
+  return x / n;
+}
+
+#endif /* threads/fixed-point.h */
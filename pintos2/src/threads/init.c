@@ -33,12 +33,14 @@
 #endif
 #ifdef VM
 #include "vm/frame.h"
+#include "vm/page.h"
 #include "vm/swap.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
 #include "devices/pci.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -56,6 +58,11 @@ static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
+
+/* -lowater, -hiwater: Free user pages below which the pageout
+   daemon starts evicting, and up to which it evicts.  0 picks a
+   default. */
+static size_t pageout_low, pageout_high;
 #endif
 #endif /* FILESYS */
 
@@ -143,6 +150,7 @@ main (void)
 #endif
 #ifdef VM
   frame_init ();
+  suppl_pt_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
@@ -150,7 +158,7 @@ main (void)
   serial_init_queue ();
 
   /* tom: calibrating the timer involves counting the number
-   * of loop iterations between timer interrupts, to measure 
+   * of CPU cycles between timer interrupts, to measure 
    * the relative speed of the processor.  So interrupts need to be on */
   timer_calibrate ();
 
@@ -164,6 +172,7 @@ main (void)
   filesys_init (format_filesys);
 #ifdef VM
   init_swap_table ();
+  frame_start_pageout (pageout_low, pageout_high);
 #endif
 #endif
 
@@ -289,15 +298,30 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-no-cache"))
+        cache_enabled = false;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-evict"))
+        {
+          if (value == NULL || !frame_set_policy (value))
+            PANIC ("unknown page replacement policy `%s'", value);
+        }
+      else if (!strcmp (name, "-lowater"))
+        pageout_low = atoi (value);
+      else if (!strcmp (name, "-hiwater"))
+        pageout_high = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        swap_set_cache_size (atoi (value));
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -420,12 +444,20 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -no-cache          Bypass the file system buffer cache.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -evict=POLICY      Evict pages by POLICY: clock (default),\n"
+          "                     clock2, wsclock or aging.\n"
+          "  -lowater=COUNT     Start paging out below COUNT free pages.\n"
+          "  -hiwater=COUNT     Page out until COUNT pages are free.\n"
+          "  -zswap=COUNT       Compress up to COUNT pages of swap in memory\n"
+          "                     (default 64, 0 to disable).\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer tick while the CPU is idle.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -2,13 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/spinlock.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,14 +24,51 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Its free pages are
+   grouped into blocks of 2**ORDER pages, aligned on 2**ORDER
+   pages from the pool's base, kept on one free list per order.
+   A request for N pages takes a block of the smallest order that
+   holds N pages, splitting a larger block if necessary, and
+   gives back the pages past the first N.  Freeing a block merges
+   it with its buddy, the other half of the block of the next
+   order up, for as long as the buddy is free too.  Both take
+   O(log n) time in the size of the pool.
+
+   Each pool also keeps a stack of up to ZEROED_MAX free pages
+   that the idle thread has already filled with zeros, through
+   palloc_zero_idle(), so that single-page PAL_ZERO requests
+   usually need no memset().  These pages are not on the free
+   lists, so they cannot be merged with their buddies, but any
+   request the free lists cannot satisfy gets them back first. */
+
+/* Number of block orders.  Blocks of the largest order are
+   2**(ORDER_CNT - 1) pages, more than any pool will have. */
+#define ORDER_CNT 20
+
+/* Value in `orders' for a page that does not start a free
+   block. */
+#define NOT_FREE 0xff
+
+/* Maximum number of pre-zeroed pages kept in a pool. */
+#define ZEROED_MAX 64
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    struct spinlock lock;               /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *orders;                    /* Order of free block at each page. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks, by order. */
+    size_t free_cnt[ORDER_CNT];         /* Lengths of free_lists. */
+    size_t zeroed[ZEROED_MAX];          /* Indexes of pre-zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of pre-zeroed pages. */
+    size_t zeroing_cnt;                 /* Pages being zeroed by idle(). */
+    unsigned long long zero_hits;       /* PAL_ZERO pages pre-zeroed. */
+    unsigned long long zero_misses;     /* PAL_ZERO pages zeroed on demand. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +77,11 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_block (struct pool *, int order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void release_zeroed (struct pool *);
+static bool zero_page (struct pool *);
+static void print_pool_stats (struct pool *, const char *name);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -73,13 +116,43 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  int order;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* Smallest order that holds PAGE_CNT pages. */
+  for (order = 0; order < ORDER_CNT && ((size_t) 1 << order) < page_cnt;
+       order++)
+    continue;
+
+  spinlock_acquire (&pool->lock);
+  if (page_cnt == 1 && (flags & PAL_ZERO) && pool->zeroed_cnt > 0) 
+    {
+      page_idx = pool->zeroed[--pool->zeroed_cnt];
+      pool->zero_hits++;
+      flags &= ~PAL_ZERO;
+    }
+  else 
+    {
+      page_idx = order < ORDER_CNT ? alloc_block (pool, order) : BITMAP_ERROR;
+      if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) 
+        {
+          /* The pre-zeroed pages are free memory too. */
+          release_zeroed (pool);
+          page_idx = alloc_block (pool, order);
+        }
+      if (page_idx != BITMAP_ERROR) 
+        {
+          free_range (pool, page_idx + page_cnt,
+                      ((size_t) 1 << order) - page_cnt);
+          ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+          bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+          if (flags & PAL_ZERO)
+            pool->zero_misses += page_cnt;
+        }
+    }
+  spinlock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -137,8 +210,11 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  spinlock_acquire (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_range (pool, page_idx, page_cnt);
+  spinlock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +224,61 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Stores the address of the user pool's first page in *BASE
+   and its number of pages in *PAGE_CNT. */
+void
+palloc_user_range (void **base, size_t *page_cnt) 
+{
+  *base = user_pool.base;
+  *page_cnt = user_pool.page_cnt;
+}
+
+/* Returns the number of free pages in the user pool, counting
+   pre-zeroed ones. */
+size_t
+palloc_user_free_cnt (void) 
+{
+  size_t cnt;
+  int order;
+
+  spinlock_acquire (&user_pool.lock);
+  cnt = user_pool.zeroed_cnt + user_pool.zeroing_cnt;
+  for (order = 0; order < ORDER_CNT; order++)
+    cnt += user_pool.free_cnt[order] << order;
+  spinlock_release (&user_pool.lock);
+  return cnt;
+}
+
+/* Fills one free page with zeros, for a later PAL_ZERO request,
+   preferring the user pool.  Called by the idle thread with
+   interrupts on.  Returns false if both pools already have
+   enough pre-zeroed pages or have no free pages left. */
+bool
+palloc_zero_idle (void) 
+{
+  return zero_page (&user_pool) || zero_page (&kernel_pool);
+}
+
+/* Prints the number of free blocks of each order in each pool. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool, "kernel pool");
+  print_pool_stats (&user_pool, "user pool");
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and orders at its base.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -164,9 +286,185 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  spinlock_init (&p->lock);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, NOT_FREE, page_cnt);
   p->base = base + bm_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  for (order = 0; order < ORDER_CNT; order++) 
+    {
+      list_init (&p->free_lists[order]);
+      p->free_cnt[order] = 0;
+    }
+  p->zeroed_cnt = p->zeroing_cnt = 0;
+  p->zero_hits = p->zero_misses = 0;
+
+  /* Every page starts out free. */
+  spinlock_acquire (&p->lock);
+  free_range (p, 0, page_cnt);
+  spinlock_release (&p->lock);
+}
+
+/* Returns the free list element stored in the first page of
+   the block at PAGE_IDX in POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx) 
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Removes a free block of the given ORDER from POOL and returns
+   the index of its first page, or BITMAP_ERROR if there is no
+   free block that large.  Splits a larger block if there is no
+   free block of ORDER, putting the unused halves on the free
+   lists.  POOL's lock must be held. */
+static size_t
+alloc_block (struct pool *pool, int order) 
+{
+  size_t page_idx;
+  int k;
+
+  ASSERT (spinlock_held (&pool->lock));
+
+  for (k = order; k < ORDER_CNT; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  page_idx = pg_no (list_pop_front (&pool->free_lists[k])) - pg_no (pool->base);
+  pool->free_cnt[k]--;
+  pool->orders[page_idx] = NOT_FREE;
+
+  /* Give back the upper half until the block is the right size. */
+  while (k > order) 
+    {
+      size_t buddy;
+
+      k--;
+      buddy = page_idx + ((size_t) 1 << k);
+      pool->orders[buddy] = k;
+      list_push_front (&pool->free_lists[k], block_elem (pool, buddy));
+      pool->free_cnt[k]++;
+    }
+  return page_idx;
+}
+
+/* Adds the free block of 2**ORDER pages at PAGE_IDX to POOL,
+   first merging it with its buddy as many times as possible.
+   POOL's lock must be held. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) 
+{
+  ASSERT (spinlock_held (&pool->lock));
+
+  for (; order < ORDER_CNT - 1; order++) 
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy + ((size_t) 1 << order) > pool->page_cnt
+          || pool->orders[buddy] != order)
+        break;
+
+      list_remove (block_elem (pool, buddy));
+      pool->free_cnt[order]--;
+      pool->orders[buddy] = NOT_FREE;
+      if (buddy < page_idx)
+        page_idx = buddy;
+    }
+
+  pool->orders[page_idx] = order;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+  pool->free_cnt[order]++;
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   need not form a block, by splitting them into the largest
+   aligned blocks possible.  POOL's lock must be held. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  while (page_cnt > 0) 
+    {
+      int order = 0;
+
+      while (order < ORDER_CNT - 1
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Returns POOL's pre-zeroed pages to its free lists.
+   POOL's lock must be held. */
+static void
+release_zeroed (struct pool *pool) 
+{
+  ASSERT (spinlock_held (&pool->lock));
+
+  while (pool->zeroed_cnt > 0) 
+    {
+      size_t page_idx = pool->zeroed[--pool->zeroed_cnt];
+      bitmap_reset (pool->used_map, page_idx);
+      free_block (pool, page_idx, 0);
+    }
+}
+
+/* Takes a free page from POOL, zeros it, and pushes it on
+   POOL's stack of pre-zeroed pages.  Returns false if the stack
+   is full or POOL has no free page. */
+static bool
+zero_page (struct pool *pool) 
+{
+  size_t page_idx;
+
+  spinlock_acquire (&pool->lock);
+  if (pool->zeroed_cnt + pool->zeroing_cnt >= ZEROED_MAX)
+    page_idx = BITMAP_ERROR;
+  else
+    page_idx = alloc_block (pool, 0);
+  if (page_idx != BITMAP_ERROR) 
+    {
+      bitmap_mark (pool->used_map, page_idx);
+      pool->zeroing_cnt++;
+    }
+  spinlock_release (&pool->lock);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  /* Zero the page without holding the pool lock.  Holding it
+     would keep interrupts off for the whole memset(), delaying
+     timer ticks and the preemption of the idle thread by a thread
+     that has just become ready, which may itself want to
+     allocate. */
+  memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+  spinlock_acquire (&pool->lock);
+  pool->zeroing_cnt--;
+  pool->zeroed[pool->zeroed_cnt++] = page_idx;
+  spinlock_release (&pool->lock);
+  return true;
+}
+
+/* Prints the number of free blocks of each order in POOL,
+   naming it NAME. */
+static void
+print_pool_stats (struct pool *pool, const char *name) 
+{
+  int order;
+
+  spinlock_acquire (&pool->lock);
+  printf ("%s free blocks by order:", name);
+  for (order = 0; order < ORDER_CNT; order++)
+    if (pool->free_cnt[order] > 0)
+      printf (" %d:%zu", order, pool->free_cnt[order]);
+  printf ("\n");
+  printf ("%s zeroed pages: %zu ready, %llu pre-zeroed, %llu zeroed on demand\n",
+          name, pool->zeroed_cnt, pool->zero_hits, pool->zero_misses);
+  spinlock_release (&pool->lock);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +474,7 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
@@ -0,0 +1,268 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator.
+
+   Each cache hands out objects of a single size.  It gets memory
+   from the page allocator one page, called a slab, at a time.
+   The slab starts with a header, followed by a stack of the
+   indexes of its free objects, followed by the objects
+   themselves.  Because the free objects are tracked outside the
+   objects, a free object keeps whatever its constructor, or its
+   last user, left in it.
+
+   A cache keeps its slabs on three lists, by whether they are
+   partly used, full, or empty, and allocates from partly used
+   slabs first so that empty ones can be given back.  When a slab
+   becomes empty it is kept for reuse if it is the cache's only
+   empty slab, and returned to the page allocator otherwise.
+   slab_reclaim() returns the rest.
+
+   Compared to malloc(), a cache does not round object sizes up
+   to a power of 2, and its lock is not shared with unrelated
+   objects of similar size. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab's page. */
+struct slab 
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects. */
+  };
+
+/* All caches, for statistics.  Caches are created while the
+   kernel initializes, so this needs no lock. */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static struct slab *new_slab (struct slab_cache *);
+static void *slab_object (struct slab *, size_t idx);
+static struct slab *object_to_slab (void *);
+
+/* Initializes cache C to hand out objects of SIZE bytes, naming
+   it NAME.  If CTOR is non-null, it is called on each object when
+   the object's slab is created. */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t size,
+                 slab_ctor_func *ctor) 
+{
+  ASSERT (c != NULL);
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+  c->objs_per_slab = ((PGSIZE - sizeof (struct slab) - (sizeof (void *) - 1))
+                      / (c->obj_size + sizeof (uint16_t)));
+  ASSERT (c->objs_per_slab > 0);
+  ASSERT (c->objs_per_slab <= UINT16_MAX);
+  c->ctor = ctor;
+  lock_init (&c->lock);
+  list_init (&c->partial_slabs);
+  list_init (&c->full_slabs);
+  list_init (&c->empty_slabs);
+  c->slab_cnt = 0;
+  c->empty_cnt = 0;
+  c->in_use_cnt = 0;
+  list_push_back (&all_caches, &c->elem);
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *c) 
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial_slabs))
+    s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+  else if (!list_empty (&c->empty_slabs)) 
+    {
+      s = list_entry (list_pop_front (&c->empty_slabs), struct slab, elem);
+      c->empty_cnt--;
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+  else 
+    {
+      s = new_slab (c);
+      if (s == NULL) 
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+
+  obj = slab_object (s, s->free[--s->free_cnt]);
+  if (s->free_cnt == 0) 
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full_slabs, &s->elem);
+    }
+  c->in_use_cnt++;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C with
+   slab_alloc(), to C. */
+void
+slab_free (struct slab_cache *c, void *obj) 
+{
+  struct slab *s;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  s = object_to_slab (obj);
+  ASSERT (s->cache == c);
+  idx = ((uint8_t *) obj - (uint8_t *) slab_object (s, 0)) / c->obj_size;
+
+  lock_acquire (&c->lock);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+#ifndef NDEBUG
+  {
+    /* Check for a double free. */
+    size_t i;
+    for (i = 0; i < s->free_cnt; i++)
+      ASSERT (s->free[i] != idx);
+  }
+#endif
+
+  if (s->free_cnt == 0) 
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+  s->free[s->free_cnt++] = idx;
+  c->in_use_cnt--;
+
+  if (s->free_cnt == c->objs_per_slab) 
+    {
+      list_remove (&s->elem);
+      if (c->empty_cnt == 0) 
+        {
+          list_push_front (&c->empty_slabs, &s->elem);
+          c->empty_cnt++;
+        }
+      else 
+        {
+          c->slab_cnt--;
+          palloc_free_page (s);
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Gives all of cache C's empty slabs back to the page allocator.
+   Returns the number of pages freed. */
+size_t
+slab_reclaim (struct slab_cache *c) 
+{
+  size_t page_cnt = 0;
+
+  lock_acquire (&c->lock);
+  while (!list_empty (&c->empty_slabs)) 
+    {
+      palloc_free_page (list_entry (list_pop_front (&c->empty_slabs),
+                                    struct slab, elem));
+      page_cnt++;
+    }
+  c->slab_cnt -= page_cnt;
+  c->empty_cnt = 0;
+  lock_release (&c->lock);
+  return page_cnt;
+}
+
+/* Prints statistics for each cache, including the memory it
+   wastes per object in use, both in total and compared to what
+   malloc() would have used for the same objects. */
+void
+slab_print_stats (void) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e)) 
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      size_t malloc_size;
+
+      lock_acquire (&c->lock);
+      for (malloc_size = 16; malloc_size < c->obj_size; malloc_size *= 2)
+        continue;
+      printf ("Slab cache %s: %zu objects of %zu bytes in %zu slabs",
+              c->name, c->in_use_cnt, c->obj_size, c->slab_cnt);
+      if (c->in_use_cnt > 0)
+        printf (", %zu bytes wasted per object (malloc: %zu)",
+                (c->slab_cnt * PGSIZE - c->in_use_cnt * c->obj_size)
+                / c->in_use_cnt,
+                malloc_size - c->obj_size);
+      printf ("\n");
+      lock_release (&c->lock);
+    }
+}
+
+/* Allocates a new slab for cache C and constructs its objects.
+   Returns a null pointer if memory is not available.  C's lock
+   must be held. */
+static struct slab *
+new_slab (struct slab_cache *c) 
+{
+  struct slab *s;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++) 
+    {
+      s->free[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor (slab_object (s, i));
+    }
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns the object numbered IDX in slab S. */
+static void *
+slab_object (struct slab *s, size_t idx) 
+{
+  struct slab_cache *c = s->cache;
+  uintptr_t objs = ROUND_UP ((uintptr_t) &s->free[c->objs_per_slab],
+                             sizeof (void *));
+
+  ASSERT (idx < c->objs_per_slab);
+  return (uint8_t *) objs + idx * c->obj_size;
+}
+
+/* Returns the slab that object OBJ is inside. */
+static struct slab *
+object_to_slab (void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid. */
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+
+  return s;
+}
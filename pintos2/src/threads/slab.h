@@ -0,0 +1,39 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Constructs object OBJ in a new slab.  Called once for each
+   object when its slab is created, not on every slab_alloc(), so
+   objects should be returned to the cache in their constructed
+   state. */
+typedef void slab_ctor_func (void *obj);
+
+/* A cache of objects of one size, carved out of whole pages
+   called slabs.  The members are private to slab.c. */
+struct slab_cache 
+  {
+    struct list_elem elem;      /* Element in list of all caches. */
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    slab_ctor_func *ctor;       /* Constructor, or a null pointer. */
+    struct lock lock;           /* Protects the members below. */
+    struct list partial_slabs;  /* Slabs with free and in-use objects. */
+    struct list full_slabs;     /* Slabs with no free objects. */
+    struct list empty_slabs;    /* Slabs with no objects in use. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t empty_cnt;           /* Number of slabs in empty_slabs. */
+    size_t in_use_cnt;          /* Number of objects allocated. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      slab_ctor_func *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+size_t slab_reclaim (struct slab_cache *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
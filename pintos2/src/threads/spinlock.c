@@ -0,0 +1,98 @@
+#include "threads/spinlock.h"
+#include <debug.h>
+#include <stddef.h>
+
+/* Atomically stores NEW in *P and returns the old value.
+
+   See [IA32-v2b] "XCHG". */
+static inline int
+atomic_xchg (volatile int *p, int new) 
+{
+  asm volatile ("xchgl %0, %1" : "+r" (new), "+m" (*p) : : "memory");
+  return new;
+}
+
+/* Initializes LOCK as free. */
+void
+spinlock_init (struct spinlock *lock) 
+{
+  ASSERT (lock != NULL);
+
+  lock->locked = 0;
+  lock->old_level = INTR_OFF;
+}
+
+/* Acquires LOCK, spinning until it becomes available, and
+   disables interrupts until it is released.  The lock must not
+   already be held.
+
+   This function does not sleep, so it may be called within an
+   interrupt handler. */
+void
+spinlock_acquire (struct spinlock *lock) 
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!spinlock_held (lock));
+
+  /* Nothing else runs while interrupts are off, so with one CPU
+     the assertion above means the exchange succeeds the first
+     time and the loop never spins. */
+  while (atomic_xchg (&lock->locked, 1) != 0)
+    while (lock->locked)
+      asm volatile ("pause");
+
+  lock->old_level = old_level;
+}
+
+/* Tries to acquire LOCK without spinning.  Returns true if
+   successful, in which case interrupts are disabled until LOCK is
+   released, or false if LOCK is already held, in which case
+   the interrupt level is unchanged. */
+bool
+spinlock_try_acquire (struct spinlock *lock) 
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!spinlock_held (lock));
+  if (atomic_xchg (&lock->locked, 1) != 0) 
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+
+  lock->old_level = old_level;
+  return true;
+}
+
+/* Releases LOCK, which must be held, and restores the
+   interrupt level saved when it was acquired. */
+void
+spinlock_release (struct spinlock *lock) 
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (spinlock_held (lock));
+
+  old_level = lock->old_level;
+  atomic_xchg (&lock->locked, 0);
+  intr_set_level (old_level);
+}
+
+/* Returns true if LOCK is held, false otherwise.  Its holder
+   keeps interrupts off and cannot be preempted, so a held
+   spinlock is always held by the running code. */
+bool
+spinlock_held (const struct spinlock *lock) 
+{
+  ASSERT (lock != NULL);
+
+  return lock->locked;
+}
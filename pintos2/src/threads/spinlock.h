@@ -0,0 +1,33 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* A spinlock.
+
+   Protects short critical sections that must not sleep against
+   interrupt handlers and against preemption.  Acquiring a
+   spinlock disables interrupts and sets the lock word; releasing
+   it restores the interrupt level that was in effect when it was
+   acquired.  Spinlocks that are held at the same time must
+   therefore be released in the reverse of the order in which
+   they were acquired.
+
+   The kernel runs on a single CPU, so the lock word is never
+   contended and a spinlock costs little more than
+   intr_disable().  The lock word names the critical section,
+   which lets spinlock_held() check that it is held. */
+struct spinlock 
+  {
+    volatile int locked;        /* 1 if held, 0 if free. */
+    enum intr_level old_level;  /* Interrupt level to restore on release. */
+  };
+
+void spinlock_init (struct spinlock *);
+void spinlock_acquire (struct spinlock *);
+bool spinlock_try_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+bool spinlock_held (const struct spinlock *);
+
+#endif /* threads/spinlock.h */
@@ -32,6 +32,8 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+static list_less_func priority_less;
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -40,12 +42,17 @@
      decrement it.
 
    - up or "V": increment the value (and wake up one waiting
-     thread, if any). */
+     thread, if any).
+
+   The value and the list of waiters are protected by a spinlock,
+   which makes both operations atomic with respect to interrupt
+   handlers. */
 void
 sema_init (struct semaphore *sema, unsigned value) 
 {
   ASSERT (sema != NULL);
 
+  spinlock_init (&sema->lock);
   sema->value = value;
   list_init (&sema->waiters);
 }
@@ -66,12 +73,15 @@ sema_down (struct semaphore *sema)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
+  spinlock_acquire (&sema->lock);
   while (sema->value == 0) 
     {
       list_push_back (&sema->waiters, &thread_current ()->elem);
-      thread_block ();
+      thread_block_and_release (&sema->lock);
+      spinlock_acquire (&sema->lock);
     }
   sema->value--;
+  spinlock_release (&sema->lock);
   intr_set_level (old_level);
 }
 
@@ -83,12 +93,11 @@ sema_down (struct semaphore *sema)
 bool
 sema_try_down (struct semaphore *sema) 
 {
-  enum intr_level old_level;
   bool success;
 
   ASSERT (sema != NULL);
 
-  old_level = intr_disable ();
+  spinlock_acquire (&sema->lock);
   if (sema->value > 0) 
     {
       sema->value--;
@@ -96,7 +105,7 @@ sema_try_down (struct semaphore *sema)
     }
   else
     success = false;
-  intr_set_level (old_level);
+  spinlock_release (&sema->lock);
 
   return success;
 }
@@ -109,17 +118,52 @@ void
 sema_up (struct semaphore *sema) 
 {
   enum intr_level old_level;
+  bool yield = false;
 
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+  spinlock_acquire (&sema->lock);
   sema->value++;
+  if (!list_empty (&sema->waiters)) 
+    {
+      /* Wake the highest-priority waiter, and let it run right
+         away if it outranks us.  The value is incremented first
+         so that it can take the semaphore as soon as it runs.
+         Once unblocked it may run, and even exit, as soon as
+         interrupts are back on, so its priority is read
+         beforehand. */
+      struct list_elem *e = list_max (&sema->waiters, priority_less, NULL);
+      struct thread *t = list_entry (e, struct thread, elem);
+
+      list_remove (e);
+      yield = t->priority > thread_get_priority ();
+      thread_unblock (t);
+    }
+  spinlock_release (&sema->lock);
+
+  if (yield) 
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
   intr_set_level (old_level);
 }
 
+/* Returns true if the thread containing list element A_ has
+   lower priority than the one containing B_. */
+static bool
+priority_less (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED) 
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority < b->priority;
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -365,3 +409,109 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  A readers-writer lock can be held either
+   by any number of readers at once or by a single writer.
+
+   Waiting writers take precedence over arriving readers, so a
+   steady stream of readers cannot starve a writer.  One
+   consequence is that a readers-writer lock, like a lock, is not
+   recursive: a thread that holds RWLOCK for reading and tries to
+   acquire it for reading again may deadlock with a waiting
+   writer. */
+void
+rwlock_init (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->readers);
+  cond_init (&rwlock->writers);
+  rwlock->reader_cnt = 0;
+  rwlock->writers_waiting = 0;
+  rwlock->writer = NULL;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no thread holds
+   it, or waits to hold it, for writing.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer != NULL || rwlock->writers_waiting > 0)
+    cond_wait (&rwlock->readers, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->reader_cnt > 0);
+  if (--rwlock->reader_cnt == 0)
+    cond_signal (&rwlock->writers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it.  RWLOCK must not already be held by the current
+   thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writers_waiting++;
+  while (rwlock->writer != NULL || rwlock->reader_cnt > 0)
+    cond_wait (&rwlock->writers, &rwlock->lock);
+  rwlock->writers_waiting--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing.  Hands the lock to the next waiting writer, if any,
+   and otherwise admits all waiting readers. */
+void
+rwlock_release_write (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer = NULL;
+  if (rwlock->writers_waiting > 0)
+    cond_signal (&rwlock->writers, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->readers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise.  (Whether the current thread holds it for
+   reading is not recorded.) */
+bool
+rwlock_held_for_write (const struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  return rwlock->writer == thread_current ();
+}
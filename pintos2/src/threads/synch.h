@@ -3,10 +3,12 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include "threads/spinlock.h"
 
 /* A counting semaphore. */
 struct semaphore 
   {
+    struct spinlock lock;       /* Protects the members below. */
     unsigned value;             /* Current value. */
     struct list waiters;        /* List of waiting threads. */
   };
@@ -41,6 +43,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock 
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers;   /* Signaled when readers may enter. */
+    struct condition writers;   /* Signaled when a writer may enter. */
+    int reader_cnt;             /* Number of threads reading. */
+    int writers_waiting;        /* Number of threads waiting to write. */
+    struct thread *writer;      /* Thread writing, if any. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* tom: DO NOT USE THIS ROUTINE UNDER ANY CIRCUMSTANCES!!!!!
  * It is not an "optimization" nor is it a "barrier" -- it is dangerous code. 
  * It is only included here because its needed for some configuration
@@ -11,6 +11,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "vm/page.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -21,9 +22,15 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queues of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority level, and bit P of
+   ready_mask is set exactly when ready_queues[P] is nonempty,
+   so the highest-priority ready thread is found with a single
+   bit scan.  ready_cnt is the total number of ready threads. */
+static struct list ready_queues[PRI_CNT];
+static uint64_t ready_mask;
+static int ready_cnt;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -55,18 +62,36 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
-/* tom: NOTE! We removed this part of the assignment, so you can ignore mlfqs */
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler, after the 4.4BSD
+   scheduler.  Each thread's priority is recomputed from its
+   nice value and recent_cpu, an exponentially decaying average
+   of the CPU time it has received.  On each tick only the
+   running thread's recent_cpu changes, so only its priority is
+   recomputed, every MLFQS_PRIORITY_TICKS ticks; the load average
+   and every thread's recent_cpu and priority are recomputed
+   once per second. */
+#define MLFQS_PRIORITY_TICKS 4  /* Ticks between priority updates. */
+static fixed_point load_avg;    /* System load average. */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
+static inline int highest_bit (uint64_t mask);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static int ready_queue_max_priority (void);
+static void change_priority (struct thread *, int priority);
+static int mlfqs_priority (const struct thread *);
+static void mlfqs_update (struct thread *, void *aux);
+static void mlfqs_tick (struct thread *);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
@@ -101,8 +126,14 @@ thread_init (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
+  int i;
+
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
+  ready_cnt = 0;
+  load_avg = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -152,6 +183,9 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   /* tom: more precisely, set a flag so that when we finish
    * handling this interrupt, we'll yield the processor to the
@@ -161,6 +195,22 @@ thread_tick (void)
     intr_yield_on_return ();
 }
 
+/* Accounts for a timer tick that went by while the CPU was
+   halted in tickless idle, in place of the thread_tick() call
+   its missing interrupt would have made: credits the tick to the
+   idle thread and does the MLFQS bookkeeping, including the
+   once-a-second load average and recent_cpu update.  Called by
+   the idle thread with interrupts off. */
+void
+thread_idle_tick (void) 
+{
+  ASSERT (thread_current () == idle_thread);
+
+  idle_ticks++;
+  if (thread_mlfqs)
+    mlfqs_tick (thread_current ());
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -223,8 +273,13 @@ thread_create (const char *name, int priority,
   sf->eip = switch_entry;
   sf->ebp = 0;
 
-  /* Add to run queue. */
+  /* Add to run queue, and run the new thread right away if it
+     outranks us.  T may exit as soon as it is unblocked, so read
+     its priority first. */
+  priority = t->priority;
   thread_unblock (t);
+  if (priority > thread_get_priority ())
+    thread_yield ();
 
   return tid;
 }
@@ -248,6 +303,26 @@ thread_block (void)
   schedule ();
 }
 
+/* Puts the current thread to sleep and releases LOCK, which
+   must be held.  The thread is marked blocked before LOCK is
+   released, so a thread_unblock() by the holder of LOCK always
+   finds it blocked.
+
+   Interrupts must be off, and remain off after LOCK is released.
+   This is for the synchronization primitives in synch.c, which
+   protect their wait lists with spinlocks. */
+void
+thread_block_and_release (struct spinlock *lock) 
+{
+  ASSERT (!intr_context ());
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  thread_current ()->status = THREAD_BLOCKED;
+  spinlock_release (lock);
+  ASSERT (intr_get_level () == INTR_OFF);
+  schedule ();
+}
+
 /* Transitions a blocked thread T to the ready-to-run state.
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
@@ -271,7 +346,7 @@ thread_unblock (struct thread *t)
  * at the end of of the list.  (There's a list_push_front.)  Calling them
  * "list_prepend" and "list_append" would have been much clearer.
  */
-  list_push_back (&ready_list, &t->elem);
+  ready_queue_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -348,7 +423,7 @@ thread_yield (void)
   old_level = intr_disable ();
 /* tom: see comment above on the misnamed "list_push_back" */
   if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+    ready_queue_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -383,11 +458,21 @@ struct thread *thread_from_tid(tid_t thread_tid)
   return NULL;
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's priority to NEW_PRIORITY.  Ignored
+   under the MLFQS, which computes priorities itself. */
 void
 thread_set_priority (int new_priority) 
 {
+  enum intr_level old_level;
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
   thread_current ()->priority = new_priority;
+  if (ready_queue_max_priority () > new_priority)
+    thread_yield ();
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's priority. */
@@ -397,40 +482,128 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* tom: You don't need to implement these routines. They are here
- * for a part of the Pintos assignment that we deleted for time. */
-
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs) 
+    {
+      cur->priority = mlfqs_priority (cur);
+      if (ready_queue_max_priority () > cur->priority)
+        thread_yield ();
+    }
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fp_round (fp_mul_int (load_avg, 100));
+  intr_set_level (old_level);
+
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fp_round (fp_mul_int (thread_current ()->recent_cpu,
+                                             100));
+  intr_set_level (old_level);
+
+  return recent_cpu_100;
+}
+
+/* Returns the priority the MLFQS assigns to T:
+   PRI_MAX - (recent_cpu / 4) - (nice * 2), clamped to the valid
+   range. */
+static int
+mlfqs_priority (const struct thread *t) 
+{
+  int priority = PRI_MAX - fp_to_int (fp_div_int (t->recent_cpu, 4))
+                 - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  return priority;
 }
-
+
+/* Decays T's recent_cpu by the load average and recomputes its
+   priority.  Called once per second for every thread, with
+   interrupts off.  AUX points to the decay coefficient,
+   (2 * load_avg) / (2 * load_avg + 1). */
+static void
+mlfqs_update (struct thread *t, void *aux) 
+{
+  const fixed_point *decay = aux;
+
+  if (t == idle_thread)
+    return;
+
+  t->recent_cpu = fp_add_int (fp_mul (*decay, t->recent_cpu), t->nice);
+  change_priority (t, mlfqs_priority (t));
+}
+
+/* Does the MLFQS bookkeeping for timer tick in which CUR was
+   running.  Runs in the timer interrupt, or in the idle thread
+   for a tick that went by while it was halted. */
+static void
+mlfqs_tick (struct thread *cur) 
+{
+  int64_t now = timer_ticks ();
+  bool recomputed = false;
+
+  if (cur != idle_thread)
+    cur->recent_cpu = fp_add_int (cur->recent_cpu, 1);
+
+  if (now % TIMER_FREQ == 0) 
+    {
+      /* The running thread is not in a run queue but counts
+         toward the load. */
+      int ready_threads = ready_cnt + (cur != idle_thread ? 1 : 0);
+      fixed_point twice_load, decay;
+
+      load_avg = fp_mul (fp_div_int (fp_from_int (59), 60), load_avg)
+                 + fp_div_int (fp_from_int (ready_threads), 60);
+      twice_load = fp_mul_int (load_avg, 2);
+      decay = fp_div (twice_load, fp_add_int (twice_load, 1));
+      thread_foreach (mlfqs_update, &decay);
+      recomputed = true;
+    }
+  else if (now % MLFQS_PRIORITY_TICKS == 0 && cur != idle_thread) 
+    {
+      /* Only the running thread's recent_cpu has changed since
+         the last update, so only its priority can have. */
+      cur->priority = mlfqs_priority (cur);
+      recomputed = true;
+    }
+
+  if (recomputed && cur != idle_thread
+      && ready_queue_max_priority () > cur->priority)
+    intr_yield_on_return ();
+}
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -456,8 +629,23 @@ idle (void *idle_started_ UNUSED)
     {
       /* Let someone else run. */
       intr_disable ();
+      timer_idle_exit ();
       thread_block ();
 
+      /* Zero free pages for later PAL_ZERO requests while nothing
+         else is ready to run.  Interrupts stay on, so a thread
+         woken meanwhile waits for at most one page. */
+      intr_enable ();
+      while (ready_cnt == 0 && palloc_zero_idle ())
+        continue;
+      intr_disable ();
+      if (ready_cnt > 0)
+        continue;
+
+      /* In tickless mode, stop the periodic timer interrupt
+         until the next alarm may be due. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -537,6 +725,17 @@ init_thread (struct thread *t, const char *name, int priority)
   t->priority = priority;
   t->magic = THREAD_MAGIC;
 
+  /* Under the MLFQS a new thread inherits its parent's nice
+     value and recent_cpu, and its priority follows from them. */
+  if (t != initial_thread) 
+    {
+      struct thread *parent = running_thread ();
+      t->nice = parent->nice;
+      t->recent_cpu = parent->recent_cpu;
+    }
+  if (thread_mlfqs)
+    t->priority = mlfqs_priority (t);
+
 #ifdef USERPROG
   t->return_status = -1;
   sema_init(&t->wait_sema, 0);
@@ -546,6 +745,8 @@ init_thread (struct thread *t, const char *name, int priority)
   t->parent = NULL;
   t->program = NULL;
 #endif
+  list_init (&t->frames);
+  lock_init (&t->vm_lock);
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -557,6 +758,22 @@ void global_init_thread (struct thread *t, const char *name, int priority) {
   init_thread (t, name, priority);
 }
 
+/* Frees T, set up by global_init_thread() but never unblocked,
+   such as the child of a fork that failed. */
+void
+global_free_thread (struct thread *t) 
+{
+  enum intr_level old_level;
+
+  ASSERT (is_thread (t));
+  ASSERT (t->status == THREAD_BLOCKED);
+
+  old_level = intr_disable ();
+  list_remove (&t->allelem);
+  intr_set_level (old_level);
+  palloc_free_page (t);
+}
+
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
    returns a pointer to the frame's base. */
 static void *
@@ -574,14 +791,94 @@ alloc_frame (struct thread *t, size_t size)
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.  The highest nonempty priority level is located
+   with a bit scan of ready_mask. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  struct thread *t;
+
+  if (ready_mask == 0)
     return idle_thread;
+
+  t = list_entry (list_front (&ready_queues[highest_bit (ready_mask)]),
+                  struct thread, elem);
+  ready_queue_remove (t);
+  return t;
+}
+
+/* Returns the index of the most significant set bit in MASK,
+   which must be nonzero. */
+static inline int
+highest_bit (uint64_t mask)
+{
+  uint32_t hi = mask >> 32;
+  uint32_t lo = mask;
+
+  ASSERT (mask != 0);
+  if (hi != 0)
+    return 63 - __builtin_clz (hi);
+  else
+    return 31 - __builtin_clz (lo);
+}
+
+/* Appends T to the back of the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_queue_push (struct thread *t)
+{
+  int level = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[level], &t->elem);
+  ready_mask |= (uint64_t) 1 << level;
+  ready_cnt++;
+}
+
+/* Removes T, which must be in the run queue for its current
+   priority, from that queue.  Interrupts must be off. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  int level = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[level]))
+    ready_mask &= ~((uint64_t) 1 << level);
+  ready_cnt--;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   PRI_MIN - 1 if no thread is ready. */
+static int
+ready_queue_max_priority (void)
+{
+  if (ready_mask == 0)
+    return PRI_MIN - 1;
+  return highest_bit (ready_mask) + PRI_MIN;
+}
+
+/* Sets T's priority to PRIORITY.  If T is sitting in a run queue
+   it is moved to the queue for its new priority. */
+static void
+change_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      ready_queue_remove (t);
+      t->priority = priority;
+      ready_queue_push (t);
+    }
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    t->priority = priority;
+
+  intr_set_level (old_level);
 }
 
 /* Completes a thread switch by activating the new thread's page
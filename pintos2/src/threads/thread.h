@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #include "threads/synch.h"
+#include "threads/fixed-point.h"
 #include "filesys/file.h" 
 #include "lib/kernel/hash.h"
 
@@ -27,6 +28,12 @@ typedef int tid_t;
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1) /* Number of priority levels. */
+
+/* Thread nice values, for the MLFQS. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default. */
+#define NICE_MAX 20                     /* Least nice. */
 
 /* tom: after you read what's below, you might wonder why Pintos 
  * allocates the thread
@@ -122,6 +129,8 @@ struct thread
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
+    int nice;                           /* Niceness, for the MLFQS. */
+    fixed_point recent_cpu;             /* Recent CPU use, for the MLFQS. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     tid_t return_status;
@@ -146,6 +155,9 @@ struct thread
     void *esp;
     struct hash suppl_page_table;      /* Supplemental page table */
     struct hash mm_files;           /*Stored active mem mapped files */
+    struct list frames;                 /* Frames owned (vm/frame.c). */
+    struct lock vm_lock;                /* Guards the page tables. */
+    bool frames_removed;                /* Frames given up on exit. */
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -157,15 +169,18 @@ extern bool thread_mlfqs;
 
 void thread_init (void);
 void global_init_thread (struct thread *, const char *name, int priority);
+void global_free_thread (struct thread *);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_tick (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
+void thread_block_and_release (struct spinlock *);
 void thread_unblock (struct thread *);
 
 struct thread *thread_current (void);
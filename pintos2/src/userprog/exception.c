@@ -6,6 +6,7 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "vm/page.h"
 
@@ -157,6 +158,30 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* Our page tables change only under our VM lock, which page
+     replacement also takes while it evicts one of our pages.  A
+     fault on a page being evicted waits here until it is saved
+     and can be brought back in, or until the eviction is undone
+     and the page is mapped again, in which case the access is
+     simply retried. */
+  lock_acquire (&cur->vm_lock);
+  if (not_present && is_user_vaddr (fault_addr) && cur->pagedir != NULL
+      && pagedir_get_page (cur->pagedir, fault_addr) != NULL)
+    {
+      lock_release (&cur->vm_lock);
+      return;
+    }
+
+  /* A write to a page shared copy-on-write since fork gets a
+     private copy of the page. */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && cur->pagedir != NULL
+      && pagedir_copy_on_write (cur->pagedir, pg_round_down (fault_addr)))
+    {
+      lock_release (&cur->vm_lock);
+      return;
+    }
+
   esp = f->esp;
   pte = vaddr_to_suppl_pte(pg_round_down(fault_addr));
 
@@ -164,27 +189,35 @@ page_fault (struct intr_frame *f)
              && (fault_addr + 32 >= esp)
              && (fault_addr > STACK_LIMIT);
 
-  if (pte != NULL || stack) {
+  if (not_present && (pte != NULL || stack)) {
     //Needs to be lazily loaded
-    uint32_t kpage = frame_get_page (PAL_USER | PAL_ZERO);
-    if (kpage == NULL) 
-    {
-      exit(-1);
-    }
-  
     if (pte != NULL) 
     {
-      load_page(pte);
+      load_page(pte, write);
+    } else if (!write) {
+      /* Read from the shared zero page until first written. */
+      cur->esp -= PGSIZE;
+      if (pagedir_get_page (cur->pagedir, cur->esp) == NULL)
+        pagedir_share_page (cur->pagedir, cur->esp, frame_zero_page (), true);
     } else {
+      void *kpage = frame_get_page (PAL_USER | PAL_ZERO);
+      if (kpage == NULL) 
+      {
+        lock_release (&cur->vm_lock);
+        exit(-1);
+      }
       cur->esp -= PGSIZE;
       bool success = (pagedir_get_page (cur->pagedir, cur->esp) == NULL
                    && pagedir_set_page (cur->pagedir, cur->esp, kpage, true));
       if (!success)
         frame_free_page (kpage);
     }
+    lock_release (&cur->vm_lock);
   } 
   else
   {
+    lock_release (&cur->vm_lock);
+
     //Is an error
     if (user)
       exit(-1);
@@ -63,8 +63,11 @@ void setup_thread_to_return_from_fork(struct thread *, struct intr_frame *);
  * to a new page directory which is a copy of the source directory.
  *
  * Each user virtual address in the source can be found in the new
- * directory, and points to a new page which contains a copy of the
- * data in the frmae mapped by that address in the source.
+ * directory, and points to the same frame as in the source.  Frames
+ * are shared copy-on-write: writable pages become read-only in both
+ * directories, and the first write to one in either process copies
+ * the frame (see pagedir_copy_on_write).  So fork takes time in the
+ * number of page tables, not in the number of resident pages.
  * 
  * Returns NULL on failure (e.g. failure of pagedir_create or
  * palloc_get_page) and a valid pointer to a new, duplicate
@@ -74,8 +77,10 @@ uint32_t*
 pagedir_duplicate (uint32_t* src_pd) {
   /* Allocate a new page directory */
   uint32_t *copy_pd = pagedir_create();
+  if (copy_pd == NULL)
+    return NULL;
 
-  /* then iterate through the old one, copying as we go */
+  /* then iterate through the old one, sharing as we go */
   uint32_t *pd = src_pd; 
   uint32_t *pde;
   for (pde = pd; pde < pd + pd_no(PHYS_BASE); ++pde) {
@@ -84,14 +89,23 @@ pagedir_duplicate (uint32_t* src_pd) {
       uint32_t *pte;
       for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++) {
         if (*pte & PTE_P) {
-          uint32_t* kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-          memcpy(kpage, pte_get_page(*pte), PGSIZE);
           uint32_t vdr = ((pde - pd) << PDSHIFT) | ((pte - pt) << PGBITS);
-          pagedir_set_page(copy_pd, (void*)vdr, kpage, *pte & PTE_W);
+          bool writable = (*pte & (PTE_W | PTE_COW)) != 0;
+          if (!pagedir_share_page(copy_pd, (void*)vdr, pte_get_page(*pte),
+                                  writable)) {
+            pagedir_destroy(copy_pd);
+            return NULL;
+          }
+          if (*pte & PTE_W)
+            *pte = (*pte & ~PTE_W) | PTE_COW;
         }
       }
     }
   } 
+
+  /* The source is the running process's directory: flush the
+     writable mappings it just lost from the TLB. */
+  pagedir_activate(src_pd);
   return copy_pd;
 } 
 
@@ -24,7 +24,8 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  A page shared copy-on-write is freed only once
+   no other page directory maps it. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -42,7 +43,7 @@ pagedir_destroy (uint32_t *pd)
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
+            frame_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
@@ -171,6 +172,75 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Adds a mapping in page directory PD from user virtual page
+   UPAGE to KPAGE, a frame that another page directory maps
+   already, sharing the frame.  The new mapping is read-only.  If
+   WRITABLE is true, the first write to UPAGE gives PD a private
+   copy of the frame through pagedir_copy_on_write().
+   UPAGE must not already be mapped.
+   Returns true if successful, false if memory allocation
+   failed. */
+bool
+pagedir_share_page (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (pg_ofs (kpage) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  pte = lookup_page (pd, upage, true);
+
+  if (pte != NULL) 
+    {
+      ASSERT ((*pte & PTE_P) == 0);
+      *pte = pte_create_user (kpage, false) | (writable ? PTE_COW : 0);
+      frame_share (kpage);
+      return true;
+    }
+  else
+    return false;
+}
+
+/* Handles a write to user virtual page UPAGE in PD, if UPAGE is
+   copy-on-write, by giving PD a private, writable copy of its
+   frame.  Returns true if successful, false if UPAGE is not
+   copy-on-write or memory allocation failed. */
+bool
+pagedir_copy_on_write (uint32_t *pd, void *upage) 
+{
+  uint32_t *pte;
+  void *page, *kpage;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte == NULL || (*pte & (PTE_P | PTE_COW)) != (PTE_P | PTE_COW))
+    return false;
+
+  page = pte_get_page (*pte);
+  kpage = frame_unshare (page, upage, pte);
+  if (kpage == NULL)
+    return false;
+
+  /* If the page was evicted meanwhile, let the write fault again
+     and bring it back in. */
+  if ((*pte & PTE_P) == 0 || pte_get_page (*pte) != page) 
+    {
+      if (kpage != page)
+        frame_free_page (kpage);
+      return true;
+    }
+
+  *pte = pte_create_user (kpage, true) | (*pte & (PTE_A | PTE_D));
+  invalidate_pagedir (pd);
+  if (kpage != page)
+    frame_free_page (page);
+  return true;
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -189,6 +259,18 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
     return NULL;
 }
 
+/* Returns the page table entry for user virtual page UPAGE in
+   PD, present or not, or a null pointer if PD has no page table
+   for UPAGE. */
+uint32_t *
+pagedir_get_pte (uint32_t *pd, const void *upage) 
+{
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  return lookup_page (pd, upage, false);
+}
+
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
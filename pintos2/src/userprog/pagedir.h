@@ -7,7 +7,10 @@
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_share_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_copy_on_write (uint32_t *pd, void *upage);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
+uint32_t *pagedir_get_pte (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
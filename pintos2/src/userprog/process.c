@@ -389,11 +389,16 @@ process_exit (void)
 
   file_close (cur->program);
 
+  /* Keep page replacement away from the frames about to be freed. */
+  frame_remove_thread (cur);
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+      suppl_pt_destroy (cur);
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
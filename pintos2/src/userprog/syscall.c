@@ -1,11 +1,14 @@
 #include "userprog/syscall.h"
 //#include "lib/user/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "threads/slab.h"
 #include "userprog/process.h"
 #include "devices/shutdown.h"
 #include "vm/page.h"
@@ -13,6 +16,7 @@
 
 #include "filesys/filesys.h"
 #include "userprog/pagedir.h"
+#include "userprog/forkutils.h"
 
 #define NUM_SYSCALLS 32
 static void syscall_handler (struct intr_frame *);
@@ -21,6 +25,15 @@ typedef void *(*handler) (void *arg1, void *arg2, void *arg3);
 
 static handler syscall_vec[NUM_SYSCALLS];
 
+/* Protects pipe_buffer_array and the pipe buffers.  File system
+   calls need no lock here: the file system synchronizes itself
+   with per-inode, directory and free map locks. */
+static struct lock pipe_lock;
+
+/* Cache of pipe buffers.  A pipe buffer is just over 1 kB,
+   which malloc() would round up to 2 kB. */
+static struct slab_cache pipe_buffer_cache;
+
 typedef int mapid_t;
 
 static void halt (void);
@@ -37,6 +50,8 @@ static unsigned tell (int fd);
 static void close (int fd);
 static int create (const char *file, unsigned initial_size);
 static bool remove (const char *file_name);
+static int read_file (struct file *, void *buffer, unsigned size);
+static int write_file (struct file *, const void *buffer, unsigned size);
 
 static bool verify_ptr(void *ptr);
 static bool verify_fd(int fd);
@@ -70,7 +85,9 @@ syscall_init (void)
   syscall_vec[SYS_MUNMAP] = (handler)munmap;
   syscall_vec[SYS_REMOVE] = (handler)remove;
 
-  lock_init (&filesys_lock);
+  lock_init (&pipe_lock);
+  slab_cache_init (&pipe_buffer_cache, "pipe_buffer",
+                   sizeof (struct pipe_buffer), NULL);
 
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
@@ -133,11 +150,47 @@ static int
 fork (struct intr_frame *f)
 {
   int i;
+  bool ok;
   struct thread *parent = thread_current();
   struct thread *child = create_child_thread ();
 
+  if (child == NULL)
+    return -1;
   setup_thread_to_return_from_fork (child, f);
+
+  /* Share the parent's memory copy-on-write.  On failure the
+     child is never started: undo what was copied and free it.
+     Both processes' page tables are locked so that page
+     replacement leaves them alone while they are copied. */
+  hash_init (&child->suppl_page_table, page_hash, page_less, NULL);
+  hash_init (&child->mm_files, mmf_hash, mmf_less, NULL);
+  child->next_id = parent->next_id;
+  lock_acquire (&parent->vm_lock);
+  lock_acquire (&child->vm_lock);
   child->pagedir = pagedir_duplicate (parent->pagedir);
+  ok = child->pagedir != NULL && suppl_pt_duplicate (child, parent);
+  lock_release (&parent->vm_lock);
+  if (!ok)
+    {
+      uint32_t *pd = child->pagedir;
+
+      /* Clear the child's page directory before destroying it,
+         so that the frame table does not take the child for one
+         of the processes still sharing a frame. */
+      child->pagedir = NULL;
+      suppl_pt_discard (child);
+      if (pd != NULL)
+        pagedir_destroy (pd);
+      lock_release (&child->vm_lock);
+      global_free_thread (child);
+      return -1;
+    }
+  lock_release (&child->vm_lock);
+  if (parent->program != NULL)
+    {
+      child->program = file_reopen (parent->program);
+      file_deny_write (child->program);
+    }
 
   //copy over fds 
   for (i = 0; i < MAX_FD; i++) 
@@ -223,20 +276,23 @@ pipe (int pipe[2])
 
   bool foundOpenIndex = false;
   int index = 0;
+  lock_acquire(&pipe_lock);
   while(!foundOpenIndex)
   {
     if(index == MAX_PIPES)
     {
+      lock_release(&pipe_lock);
       return -1;
     }
     if(pipe_buffer_array[index] == NULL)
     {
       //found a spot to store our pipe
       foundOpenIndex = true;
-      struct pipe_buffer *buffer = calloc(1, sizeof(struct pipe_buffer));
+      struct pipe_buffer *buffer = slab_alloc (&pipe_buffer_cache);
       if(buffer == NULL)
       {
-        //calloc failed
+        //allocation failed
+        lock_release(&pipe_lock);
         return -1;
       }
       buffer->start = 0;
@@ -259,6 +315,7 @@ pipe (int pipe[2])
       index++;
     }    
   }
+  lock_release(&pipe_lock);
   return 0;
 }
 
@@ -275,7 +332,6 @@ open (const char *file)
     exit(-1);
  
 
-  lock_acquire(&filesys_lock);
   //read size bytes from fd(file) into buffer
   struct file **fds = thread_current()->fds;
   int index = 3; //FD 0, 1, 2 are reserver for std in, out, err
@@ -286,7 +342,6 @@ open (const char *file)
     if(index == MAX_FD) 
     {
       //we ran out of FDs
-      lock_release(&filesys_lock);
       return -1;
     }
     if(fds[index] == NULL)
@@ -297,7 +352,6 @@ open (const char *file)
       if(opened == NULL)
       {
         //not a file
-         lock_release(&filesys_lock);
          return -1;
       }
 
@@ -310,7 +364,6 @@ open (const char *file)
     }
   }
 
-  lock_release(&filesys_lock);
   return index;
 }
 
@@ -324,9 +377,7 @@ filesize (int fd)
   if (file == NULL)
     return -1;
 
-  lock_acquire(&filesys_lock);
   int length = file_length (file);
-  lock_release(&filesys_lock);
 
   return length;
 }
@@ -334,11 +385,9 @@ filesize (int fd)
 static int 
 read (int fd, void *buffer, unsigned size)
 {
-  lock_acquire(&filesys_lock);
   int i;
   if (!verify_ptr(buffer) || !verify_ptr(buffer + size))
   {
-    lock_release(&filesys_lock);
     exit(-1);
   } 
   int bytes_read; 
@@ -351,13 +400,11 @@ read (int fd, void *buffer, unsigned size)
       {
         *(char *)(buffer + i) = input_getc();
       }
-      lock_release(&filesys_lock);
       return size;
     }
 
     if (fd == 1)
     {
-      lock_release(&filesys_lock);
       return -1;
     }
 
@@ -365,10 +412,9 @@ read (int fd, void *buffer, unsigned size)
     if(file == NULL)
     {
       //this FD is not in use right now
-      lock_release(&filesys_lock);
       return -1;
     }
-    bytes_read = file_read(file, buffer, size);
+    bytes_read = read_file(file, buffer, size);
   }
   else if((fd < (MAX_FD + MAX_PIPES * 2)) && (fd >= 0)) //each pipe is 2 FDs
   {
@@ -376,10 +422,10 @@ read (int fd, void *buffer, unsigned size)
     if(fd % 2 == 1)
     {
       //odd pipe FDs are for writing ends of the pipe, can't read from it!
-      lock_release(&filesys_lock);
       return -1;
     }
     //find the index the pipe_buffer struct is stored in our pipe_buffer array
+    lock_acquire(&pipe_lock);
     int pipe_array_index = (fd - MAX_FD) / 2;
     struct pipe_buffer *pipe_buffer = pipe_buffer_array[pipe_array_index];
     int read_index = pipe_buffer->start; //next char to be read
@@ -396,22 +442,20 @@ read (int fd, void *buffer, unsigned size)
     //update inforamtion in pipe buffer struct
     pipe_buffer->start = read_index;
     pipe_buffer->size = chars_in_pipe_buffer;
+    lock_release(&pipe_lock);
     bytes_read = buffer_index;
   }
   else
   {
     //invalid FD
-    lock_release(&filesys_lock);
     return -1;
   }
-  lock_release(&filesys_lock);
   return bytes_read;
 }
 
 static int 
 write (int fd, const void *buffer, unsigned size)
 {
-  lock_acquire(&filesys_lock);
   if (!verify_ptr(buffer) || !verify_ptr(buffer + size))
     exit(-1);
 
@@ -421,14 +465,12 @@ write (int fd, const void *buffer, unsigned size)
     //case where we are writing to a normal file
     if (fd == 0) 
     {
-      lock_release(&filesys_lock);
       return -1;
     }
 
     if (fd == 1)
     {
       putbuf (buffer, size);
-      lock_release(&filesys_lock);
       return size;
     }
   
@@ -436,11 +478,10 @@ write (int fd, const void *buffer, unsigned size)
     //make sure FD points to an open file
     if(!file)
     {
-      lock_release(&filesys_lock);
       return -1;
     }
 
-    bytes_written = file_write(file, buffer, size);
+    bytes_written = write_file(file, buffer, size);
   }
   else if((fd >= 0) && (fd < (MAX_FD + MAX_PIPES * 2)))
   {
@@ -448,10 +489,10 @@ write (int fd, const void *buffer, unsigned size)
     if(fd % 2 == 0)
     {
       //even pipe FDs are for reading ends of the pipe, you can't write to it!
-      lock_release(&filesys_lock);
       return -1;
     }
 
+    lock_acquire(&pipe_lock);
     int pipe_array_index = (fd - MAX_FD - 1) / 2;
     struct pipe_buffer *pipe_buffer = pipe_buffer_array[pipe_array_index];
     int write_index = pipe_buffer->end; //index to write next char
@@ -468,34 +509,84 @@ write (int fd, const void *buffer, unsigned size)
     //update information in our pipe buffer struct
     pipe_buffer->end = write_index;
     pipe_buffer->size = chars_in_pipe_buffer;
+    lock_release(&pipe_lock);
     bytes_written = buffer_index;
   }
   else
   {
     //invalid FD
-    lock_release(&filesys_lock);
     return -1;
   }
-  lock_release(&filesys_lock);
   return bytes_written;
 }
 
+/* Reads SIZE bytes from FILE into user BUFFER a page at a time,
+   by way of a kernel bounce buffer, and returns the number of
+   bytes read.  The file system holds cache and inode locks while
+   it copies data, and a page fault on BUFFER may need those same
+   locks to bring in a memory mapped or executable page, so it
+   must never touch user memory itself. */
+static int
+read_file (struct file *file, void *buffer, unsigned size)
+{
+  uint8_t *bounce = palloc_get_page (0);
+  unsigned total = 0;
+
+  if (bounce == NULL)
+    return -1;
+  while (total < size)
+    {
+      unsigned chunk = size - total < PGSIZE ? size - total : PGSIZE;
+      off_t n = file_read_ahead (file, bounce, chunk);
+
+      memcpy (buffer + total, bounce, n);
+      total += n;
+      if ((unsigned) n < chunk)
+        break;
+    }
+  palloc_free_page (bounce);
+  return total;
+}
+
+/* Writes SIZE bytes from user BUFFER to FILE a page at a time,
+   by way of a kernel bounce buffer, and returns the number of
+   bytes written.  See read_file(). */
+static int
+write_file (struct file *file, const void *buffer, unsigned size)
+{
+  uint8_t *bounce = palloc_get_page (0);
+  unsigned total = 0;
+
+  if (bounce == NULL)
+    return -1;
+  while (total < size)
+    {
+      unsigned chunk = size - total < PGSIZE ? size - total : PGSIZE;
+      off_t n;
+
+      memcpy (bounce, buffer + total, chunk);
+      n = file_write (file, bounce, chunk);
+      total += n;
+      if ((unsigned) n < chunk)
+        break;
+    }
+  palloc_free_page (bounce);
+  return total;
+}
+
 static unsigned 
 tell (int fd)
 {
   if (!verify_fd(fd))
     return -1;
 
-  lock_acquire(&filesys_lock);
   int pos = file_tell(thread_current()->fds[fd]);
-  lock_release(&filesys_lock);
   return pos;
 }
 
 static void 
 close (int fd)
 {
-  lock_acquire(&filesys_lock);
   if((fd >= 0) && (fd < MAX_FD))
   {
     //case where FD is for a regular file
@@ -518,6 +609,7 @@ close (int fd)
       //one is read end, other is write end
       fd--;
     }
+    lock_acquire(&pipe_lock);
     int pipe_array_index = (fd - MAX_FD) / 2; 
     struct pipe_buffer *pipe_buffer = pipe_buffer_array[pipe_array_index];
     if(read_end)
@@ -532,12 +624,12 @@ close (int fd)
     //if both ends are closed, free the memory
     if((pipe_buffer->fd_write == -1) && (pipe_buffer->fd_read == -1))
     {
-      free(pipe_buffer);
+      slab_free (&pipe_buffer_cache, pipe_buffer);
       pipe_buffer_array[pipe_array_index] = NULL;
     }
+    lock_release(&pipe_lock);
   }
   //else invalid FD, nothing to close
-  lock_release(&filesys_lock);
 }
 
 static bool verify_ptr(void *ptr) {
@@ -599,6 +691,9 @@ static mapid_t mmap(int fd, void *addr)
     return -1;
   }
   
+  //page tables are locked against page replacement from here on
+  lock_acquire (&t->vm_lock);
+
   //check if there is enough space to mmap file
   int index = 0;
   while(index < length)
@@ -608,23 +703,25 @@ static mapid_t mmap(int fd, void *addr)
     bool pagedir_exists = pagedir_get_page(t->pagedir, addr + index);
     if(suppl_pte_exists || pagedir_exists)
     {
+      lock_release (&t->vm_lock);
       return -1;
     }
     index += PGSIZE;
   }
-  lock_acquire(&filesys_lock);
   struct file *mmf_file = file_reopen(file);
-  lock_release(&filesys_lock);  
 
   if(mmf_file == NULL)
   {
+    lock_release (&t->vm_lock);
     return -1;
   }
 
   //put file in mm_file struct and add to current threads hash of MMFs
-  struct mm_file *mmap_file = malloc(sizeof (struct mm_file));
+  struct mm_file *mmap_file = mm_file_alloc ();
   if(mmap_file == NULL)
   {
+    file_close (mmf_file);
+    lock_release (&t->vm_lock);
     return -1;
   }
 
@@ -632,7 +729,7 @@ static mapid_t mmap(int fd, void *addr)
   t->next_id = id + 1;
 
   mmap_file->mm_id = id;
-  mmap_file->file = file;
+  mmap_file->file = mmf_file;
   mmap_file->start_addr = addr;
   index = 0;
   int page_count = 0;
@@ -653,6 +750,8 @@ static mapid_t mmap(int fd, void *addr)
 
     if(!insert)
     {
+      mm_file_free (mmap_file);
+      lock_release (&t->vm_lock);
       return -1;
     }
     index += PGSIZE;
@@ -663,6 +762,7 @@ static mapid_t mmap(int fd, void *addr)
   mmap_file->pg_count = page_count;
 
   hash_insert(&t->mm_files, &mmap_file->elem);
+  lock_release (&t->vm_lock);
 
   return id;
 }
@@ -672,6 +772,7 @@ static void munmap(mapid_t mapping)
   struct mm_file mm_file_lookup;
   mm_file_lookup.mm_id = mapping;
   struct thread *t = thread_current();
+  lock_acquire (&t->vm_lock);
   struct hash_elem *elem = hash_delete(&t->mm_files, &mm_file_lookup.elem);
   if(elem != NULL)
   {
@@ -691,22 +792,22 @@ static void munmap(mapid_t mapping)
         struct suppl_pte *pte_ptr = hash_entry(elem, struct suppl_pte, elem);
         if(pte_ptr->loaded && pagedir_is_dirty(t->pagedir, pte_ptr->vaddr))
         {
-          //write back to disk
-          lock_acquire(&filesys_lock);
+          //write back to disk, from the kernel's mapping of the page
+          //so that the file system never touches user memory
           file_seek(pte_ptr->file, pte_ptr->file_offset);
-          file_write(pte_ptr->file, pte_ptr->vaddr, pte_ptr->bytes_read);
-  
-
-          lock_release(&filesys_lock);
+          file_write(pte_ptr->file,
+                     pagedir_get_page(t->pagedir, pte_ptr->vaddr),
+                     pte_ptr->bytes_read);
         }
+        suppl_pte_free (pte_ptr);
       }
       pg_count--;
       count++;
     }
-    lock_acquire(&filesys_lock);
-    file_close(mm_file); 
-    lock_release(&filesys_lock);
+    file_close(mm_file->file);
+    mm_file_free (mm_file);
   }
+  lock_release (&t->vm_lock);
 }
 
 bool remove (const char *file_name)
@@ -715,9 +816,7 @@ bool remove (const char *file_name)
   {
     exit(-1);
   }
-  lock_acquire(&filesys_lock);
   bool success = filesys_remove(file_name); 
-  lock_release(&filesys_lock);
   return success;
 
 }
@@ -5,8 +5,6 @@
 #define MAX_PIPES 128 //max number of pipes that can be open at any given time
 #define MAX_FD 128 //max number of regular file descriptors a thread can have open
 
-struct lock filesys_lock;
-
 void syscall_init (void);
 void exit (int status);
 
@@ -1,29 +1,275 @@
 #include "frame.h"
-#include "threads/malloc.h"
+#include <round.h>
+#include <string.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
-#include "userprog/pagedir.h"
-#include "vm/page.h"
 #include "threads/vaddr.h"
 #include "threads/pte.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
 #include "vm/swap.h"
-#include "threads/malloc.h"
-#include <string.h>
-#include <stdio.h>
 
-static void *frame_replace_page (void);
-static struct list_elem *hand;
+/* The frame table, indexed by page number within the user pool,
+ * so that finding the entry for a page takes constant time. */
+static struct frame *frames;
+static uint8_t *user_base;      /* First page of the user pool. */
+static size_t frame_cnt;        /* Number of pages in the user pool. */
+
+/* Protects the frame table. */
+static struct lock frame_lock;
+
+/* Serializes eviction.  Also keeps a process from exiting while
+ * one of its frames is being evicted. */
+static struct lock evict_lock;
+
+/* The shared zero page, mapped read-only wherever a zero-filled
+ * page is read before it is written.  It keeps a reference of
+ * its own, so that it is never freed or evicted, and
+ * frame_unshare() always copies it. */
+static void *zero_page;
+
+/* Read-only pages of executables, shared by all the processes
+ * that run them, by inode, offset and length.  A page leaves the
+ * table when it is evicted or no process maps it any more, so an
+ * executable can't be written while its pages are here: running
+ * processes deny writes to their executables.  Protected by
+ * frame_lock. */
+static struct hash text_pages;
+
+/* Clock hand: the next frame to consider for eviction. */
+static size_t hand;
+
+/* A page replacement policy.  SELECT chooses a frame to evict
+ * among those that evictable() accepts, or returns NULL if there
+ * is none.  It is called with frame_lock held. */
+struct evict_policy
+{
+  const char *name;                     /* Name, for -evict=NAME. */
+  struct frame *(*select) (void);       /* Chooses a victim. */
+};
+
+static struct frame *clock_select (void);
+static struct frame *clock2_select (void);
+static struct frame *wsclock_select (void);
+static struct frame *aging_select (void);
+
+static const struct evict_policy policies[] =
+{
+  {"clock", clock_select},
+  {"clock2", clock2_select},
+  {"wsclock", wsclock_select},
+  {"aging", aging_select},
+};
 
-static bool add_frame (void *);
+/* Policy in use, set by -evict. */
+static const struct evict_policy *policy = &policies[0];
+
+/* Ticks after its last use at which wsclock considers a page
+ * out of its process's working set. */
+#define WS_TAU (TIMER_FREQ / 2)
+
+/* Ticks per aging step: a page's age shifts right by one for
+ * each.  last_aging is when the last step was due. */
+#define AGE_INTERVAL (TIMER_FREQ / 10)
+static int64_t last_aging;
+
+/* Pageout daemon.  Once fewer than low_water user frames are
+ * free, frame_get_page() wakes it, and it evicts pages until
+ * high_water frames are free, so that page faults seldom have
+ * to wait for a page to be written out.  low_water is 0 until
+ * the daemon starts. */
+static size_t low_water, high_water;
+static struct semaphore pageout_sema;
+static bool pageout_wanted;     /* Daemon woken, not yet done. */
+
+/* Most pages the pageout daemon evicts at once.  Those bound for
+ * swap are written to adjacent slots in one pass. */
+#define PAGEOUT_BATCH 8
+
+/* A frame taken from its owner for eviction, with the mapping it
+ * had, whether the page was dirty, and the swap slot its
+ * contents went to, if any.  The page is unmapped as soon as it
+ * is taken, so that no store to it can be lost while it is
+ * saved.  The owner's vm_lock is held until the eviction is
+ * over, so that the owner does not change its page tables
+ * meanwhile, and a fault on the page waits for the eviction to
+ * finish; LOCKED tells whether this victim took it, rather than
+ * an earlier victim of the same owner or the owner itself */
+struct victim
+{
+  struct frame *frame;
+  struct thread *owner;
+  void *uvaddr;
+  uint32_t *pte;
+  bool dirty;
+  struct suppl_pte *spte;
+  size_t swap_index;
+  bool locked;
+};
+
+/* A search for the process that still maps a frame.  See
+ * find_owner() */
+struct owner_search
+{
+  struct frame *frame;          /* Frame to find the mapper of. */
+  struct thread *owner;         /* Mapper found, or NULL. */
+  uint32_t *pte;                /* OWNER's page table entry for it. */
+};
+
+/* Statistics. */
+static long long evict_cnt;     /* Frames evicted. */
+static long long scan_cnt;      /* Frames examined to choose them. */
+static long long direct_cnt;    /* Evicted by a faulting thread. */
+static long long background_cnt; /* Evicted by the pageout daemon. */
+static long long zero_share_cnt; /* Mappings of the zero page. */
+static long long zero_copy_cnt; /* Zero page copies on write. */
+static long long text_hit_cnt;  /* Text pages found shared. */
+static long long text_miss_cnt; /* Text pages read in. */
+
+static struct frame *page_to_frame (void *);
+static void *frame_to_page (struct frame *);
+static void set_owner (struct frame *, struct thread *);
+static void claim_frame (void *);
+static void forget_text_page (struct frame *);
+static void find_owner (struct frame *);
+static thread_action_func match_owner;
+static hash_hash_func text_hash;
+static hash_less_func text_less;
 static void *frame_replace_page (void);
-static struct frame *select_evictee (void);
-static bool save_frame (struct frame *);
-static struct frame *get_frame (void *);
+static size_t pageout_batch (size_t);
+static void wake_pageout (void);
+static void pageout_daemon (void *);
+static bool evictable (struct frame *);
+static bool vm_busy (struct thread *);
+static bool lock_owner (struct victim *, struct thread *);
+static void unlock_owner (struct victim *);
+static bool test_and_clear_accessed (struct frame *);
+static bool detach_victim (struct victim *);
+static void restore_victim (struct victim *);
+static void sort_victims (struct victim *, size_t);
+static bool prepare_save (struct victim *, bool *to_swap);
+static void finish_save (struct victim *);
+
+/* Selects the page replacement policy named NAME.  Returns false
+ * if there is no such policy */
+bool frame_set_policy (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp (name, policies[i].name))
+    {
+      policy = &policies[i];
+      return true;
+    }
+  return false;
+}
 
 void frame_init (void)
 {
-  list_init (&frame_list);
+  size_t table_pages;
+
+  palloc_user_range ((void **) &user_base, &frame_cnt);
+  table_pages = DIV_ROUND_UP (frame_cnt * sizeof *frames, PGSIZE);
+  frames = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, table_pages);
   lock_init (&frame_lock);
   lock_init (&evict_lock);
+  sema_init (&pageout_sema, 0);
+  hash_init (&text_pages, text_hash, text_less, NULL);
+
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_USER | PAL_ZERO);
+  claim_frame (zero_page);
+}
+
+/* Returns the shared zero page, to be mapped with
+ * pagedir_share_page() */
+void *frame_zero_page (void)
+{
+  return zero_page;
+}
+
+/* Looks for the read-only page of executable INODE at offset
+ * OFS, of which READ_BYTES come from INODE and the rest are
+ * zeros, among those other processes have in memory.  Returns
+ * it with a new reference for the caller to map, or returns NULL
+ * if it is not in memory */
+void *frame_get_text_page (struct inode *inode, off_t ofs,
+                           uint32_t read_bytes)
+{
+  struct frame key;
+  struct hash_elem *e;
+  struct frame *frame = NULL;
+
+  key.inode = inode;
+  key.file_ofs = ofs;
+  key.read_bytes = read_bytes;
+
+  lock_acquire (&frame_lock);
+  e = hash_find (&text_pages, &key.text_elem);
+  if (e != NULL)
+  {
+    frame = hash_entry (e, struct frame, text_elem);
+    frame->ref_cnt++;
+    text_hit_cnt++;
+  }
+  else
+    text_miss_cnt++;
+  lock_release (&frame_lock);
+
+  return frame != NULL ? frame_to_page (frame) : NULL;
+}
+
+/* Offers PAGE, just read from executable INODE as described for
+ * frame_get_text_page(), for sharing with other processes.
+ * Returns PAGE, or if another process read the same page in
+ * meanwhile, frees PAGE and returns that one, with a new
+ * reference, instead */
+void *frame_add_text_page (void *page, struct inode *inode, off_t ofs,
+                           uint32_t read_bytes)
+{
+  struct frame *frame = page_to_frame (page);
+  struct hash_elem *e;
+
+  ASSERT (frame != NULL && frame->ref_cnt == 1 && frame->inode == NULL);
+
+  lock_acquire (&frame_lock);
+  frame->inode = inode;
+  frame->file_ofs = ofs;
+  frame->read_bytes = read_bytes;
+  e = hash_insert (&text_pages, &frame->text_elem);
+  if (e != NULL)
+  {
+    struct frame *other = hash_entry (e, struct frame, text_elem);
+    frame->inode = NULL;
+    other->ref_cnt++;
+    lock_release (&frame_lock);
+    frame_free_page (page);
+    return frame_to_page (other);
+  }
+  lock_release (&frame_lock);
+  return page;
+}
+
+/* Starts the pageout daemon, which keeps between LOW and HIGH
+ * user frames free.  Zero for either picks a default based on
+ * the size of the user pool.  Call once swap is available */
+void frame_start_pageout (size_t low, size_t high)
+{
+  if (low == 0)
+    low = frame_cnt / 32 > 0 ? frame_cnt / 32 : 1;
+  if (high <= low)
+    high = 2 * low;
+  if (high > frame_cnt / 2)
+    high = frame_cnt / 2;
+  if (low >= high)
+    return;
+
+  high_water = high;
+  if (thread_create ("pageout", PRI_DEFAULT, pageout_daemon, NULL)
+      != TID_ERROR)
+    low_water = low;
 }
 
 //allocate page from user_pool
@@ -31,226 +277,754 @@ void frame_init (void)
 void *frame_get_page(enum palloc_flags flags) 
 {
   ASSERT (flags & PAL_USER);
-  void *frame = NULL;
-  //get a page from user pool
-  if(flags & PAL_USER)
+  void *page = palloc_get_page (PAL_USER | PAL_ZERO);
+  wake_pageout ();
+  if (page == NULL)
   {
-    if(flags & PAL_USER)
+    page = frame_replace_page ();
+    if (page != NULL)
+      direct_cnt++;
+    return page;
+  }
+
+  claim_frame (page);
+  return page;
+}
+
+/* Like frame_get_page(), but for speculative use such as swap
+ * readahead: returns NULL instead of evicting a page, and when
+ * free frames are already short */
+void *frame_try_get_page (void)
+{
+  void *page;
+
+  if (palloc_user_free_cnt () <= low_water)
+    return NULL;
+  page = palloc_get_page (PAL_USER | PAL_ZERO);
+  if (page != NULL)
+    claim_frame (page);
+  return page;
+}
+
+/* Drops a reference to PAGE, freeing it once no page table
+ * maps it any more */
+void frame_free_page (void *page)
+{
+  struct frame *frame = page_to_frame (page);
+
+  if (frame != NULL)
+  {
+    lock_acquire (&frame_lock);
+    ASSERT (frame->ref_cnt > 0);
+    if (--frame->ref_cnt > 0)
     {
-      frame = palloc_get_page(PAL_USER | PAL_ZERO);
+      /* Still mapped.  If the recorded mapper is the one letting
+       * go, the frame has no known owner, and can't be evicted,
+       * until a remaining mapper is found.  Only one is left to
+       * look for once the frame is no longer shared. */
+      if (frame->owner == thread_current ())
+        set_owner (frame, NULL);
+      if (frame->ref_cnt == 1 && frame->owner == NULL && page != zero_page)
+        find_owner (frame);
+      lock_release (&frame_lock);
+      return;
     }
-    else
+    set_owner (frame, NULL);
+    forget_text_page (frame);
+    lock_release (&frame_lock);
+  }
+
+  palloc_free_page(page);
+}
+
+/* Adds a reference to PAGE, which another page table is about
+ * to map copy-on-write */
+void frame_share (void *page)
+{
+  struct frame *frame = page_to_frame (page);
+  if (frame != NULL)
+  {
+    lock_acquire (&frame_lock);
+    frame->ref_cnt++;
+    if (page == zero_page)
+      zero_share_cnt++;
+    lock_release (&frame_lock);
+  }
+}
+
+/* Gives the current thread a private copy of shared frame PAGE,
+ * mapped at UPAGE through page table entry PTE.  If no one else
+ * maps PAGE any more, claims PAGE itself instead of copying it.
+ * Returns the private frame, or NULL if memory runs out.  PTE
+ * keeps its reference to PAGE: once the caller has pointed PTE
+ * at a copy, it drops that reference with frame_free_page().
+ * If PTE no longer maps PAGE by the time the frame table is
+ * locked, because PAGE was evicted meanwhile, returns PAGE
+ * without doing anything */
+void *frame_unshare (void *page, void *upage, uint32_t *pte)
+{
+  struct frame *frame = page_to_frame (page);
+  void *copy;
+
+  lock_acquire (&frame_lock);
+  if ((*pte & PTE_P) == 0 || pte_get_page (*pte) != page)
+  {
+    lock_release (&frame_lock);
+    return page;
+  }
+  if (frame == NULL || frame->ref_cnt == 1)
+  {
+    if (frame != NULL)
     {
-      frame = palloc_get_page(PAL_USER);
+      set_owner (frame, thread_current ());
+      frame->uvaddr = upage;
+      frame->pte = pte;
     }
+    lock_release (&frame_lock);
+    return page;
   }
 
-  //on success, add frame to list
-  if(frame != NULL)
+  /* Pin PAGE with a reference of our own while copying it: with
+   * frame_lock released, the other mappers may let go of PAGE,
+   * and a frame with a single reference can be evicted. */
+  frame->ref_cnt++;
+  lock_release (&frame_lock);
+
+  copy = frame_get_page (PAL_USER);
+  if (copy != NULL)
   {
-    add_frame(frame);
+    if (page != zero_page)
+      memcpy (copy, page, PGSIZE);
+    else
+      zero_copy_cnt++;
+    frame_set_user_page (copy, upage, pte);
   }
-  else
+  frame_free_page (page);
+  return copy;
+}
+
+/* Sets the page table entry and the virtual address of the frame */
+void frame_set_user_page (void *page, void *upage, uint32_t *pte)
+{
+  struct frame *frame = page_to_frame (page);
+  if (frame != NULL)
   {
-    frame = frame_replace_page ();
+    lock_acquire (&frame_lock);
+    set_owner (frame, thread_current ());
+    frame->uvaddr = upage;
+    frame->pte = pte;
+    lock_release (&frame_lock);
   }
-  return frame;
 }
 
-void frame_free_page (void *page)
+/* Disowns the frames that process T maps, just before its page
+ * directory is destroyed, so that page replacement leaves them
+ * alone.  Touches only T's own frames. */
+void frame_remove_thread (struct thread *t)
 {
-  struct list_elem *e;
-  struct frame *frame;
-  for (e = list_begin (&frame_list); e != list_end (&frame_list);
-       e = list_next (e))
+  lock_acquire (&evict_lock);
+  lock_acquire (&frame_lock);
+  while (!list_empty (&t->frames))
+  {
+    struct frame *frame = list_entry (list_pop_front (&t->frames),
+                                      struct frame, owner_elem);
+    frame->owner = NULL;
+  }
+  t->frames_removed = true;
+  lock_release (&frame_lock);
+  lock_release (&evict_lock);
+}
+
+/* Prints page replacement statistics */
+void frame_print_stats (void)
+{
+  printf ("Frames: %s policy, %lld evictions (%lld direct, %lld background), "
+          "%lld frames scanned\n",
+          policy->name, evict_cnt, direct_cnt, background_cnt, scan_cnt);
+  printf ("Zero page: %lld mappings, %lld copied on write\n",
+          zero_share_cnt, zero_copy_cnt);
+  printf ("Text pages: %lld shared, %lld read in\n",
+          text_hit_cnt, text_miss_cnt);
+}
+
+/* Wakes the pageout daemon if free user frames have fallen
+ * below the low watermark and it is not already at work */
+static void wake_pageout (void)
+{
+  bool wake = false;
+
+  if (low_water == 0 || palloc_user_free_cnt () >= low_water)
+    return;
+
+  lock_acquire (&frame_lock);
+  if (!pageout_wanted)
+    wake = pageout_wanted = true;
+  lock_release (&frame_lock);
+
+  if (wake)
+    sema_up (&pageout_sema);
+}
+
+/* Pageout daemon thread.  Each time it is woken, evicts pages
+ * with the current policy, writing dirty ones out, and returns
+ * them to the user pool until high_water frames are free or
+ * nothing more can be evicted */
+static void pageout_daemon (void *aux UNUSED)
+{
+  for (;;)
+  {
+    sema_down (&pageout_sema);
+
+    for (;;)
     {
-      frame = list_entry (e, struct frame, frame_elem);
-      
-      free (frame);
+      size_t free_cnt = palloc_user_free_cnt ();
+      size_t cnt;
+
+      if (free_cnt >= high_water)
+        break;
+      cnt = pageout_batch (high_water - free_cnt);
+      if (cnt == 0)
+        break;
+      background_cnt += cnt;
     }
 
-  palloc_free_page(page);
+    lock_acquire (&frame_lock);
+    pageout_wanted = false;
+    lock_release (&frame_lock);
+  }
+}
+
+/* Returns the frame table entry for user pool page PAGE, or NULL
+ * if PAGE is not in the user pool */
+static struct frame *page_to_frame (void *page)
+{
+  size_t idx = pg_no (page) - pg_no (user_base);
+
+  ASSERT (pg_ofs (page) == 0);
+  return idx < frame_cnt ? &frames[idx] : NULL;
+}
+
+/* Returns the page that FRAME describes */
+static void *frame_to_page (struct frame *frame)
+{
+  return user_base + (frame - frames) * PGSIZE;
+}
+
+/* Marks free user pool PAGE as in use by one page table, not
+ * yet known */
+static void claim_frame (void *page)
+{
+  struct frame *frame = page_to_frame (page);
+
+  lock_acquire (&frame_lock);
+  ASSERT (frame->ref_cnt == 0);
+  frame->ref_cnt = 1;
+  frame->uvaddr = NULL;
+  frame->pte = NULL;
+  frame->last_use = timer_ticks ();
+  frame->age = 0;
+  frame->inode = NULL;
+  lock_release (&frame_lock);
 }
 
-//add frame to frame table
-static bool add_frame(void *f)
+/* Takes FRAME out of the text page table, if it is there, before
+ * its page is reused.  frame_lock must be held */
+static void forget_text_page (struct frame *frame)
 {
-  struct frame *frame = malloc(sizeof(struct frame));
-  if(frame == NULL)
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (frame->inode != NULL)
   {
-    return false;
+    hash_delete (&text_pages, &frame->text_elem);
+    frame->inode = NULL;
   }
-  struct thread *t = thread_current();
-  frame->tid = t->tid;
-  frame->frame = f;
+}
 
-  lock_acquire(&frame_lock);
-  list_push_back(&frame_list, &frame->frame_elem);
-  lock_release(&frame_lock);
-  return true;
+/* Looks for the process that still maps FRAME, which is mapped
+ * once but has no owner since the owner recorded for it let it
+ * go, and makes it the owner, so that FRAME can be evicted
+ * again.  The processes sharing a page copy-on-write since fork,
+ * or a page of the same executable, map it at the same virtual
+ * address, which is where FRAME was last mapped, so only that
+ * address is checked in each page directory.  frame_lock must be
+ * held */
+static void find_owner (struct frame *frame)
+{
+  struct owner_search s;
+  enum intr_level old_level;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (frame->uvaddr == NULL)
+    return;
+
+  s.frame = frame;
+  s.owner = NULL;
+  old_level = intr_disable ();
+  thread_foreach (match_owner, &s);
+  intr_set_level (old_level);
+
+  if (s.owner != NULL)
+  {
+    set_owner (frame, s.owner);
+    frame->pte = s.pte;
+  }
 }
 
-/* Evicts a frame from the frame list */
-static void *frame_replace_page () 
+/* Records T in the owner_search at S_ if T maps S_'s frame at
+ * its virtual address.  Processes that have given up their
+ * frames on exit are passed over.  A thread_action_func for
+ * find_owner() */
+static void match_owner (struct thread *t, void *s_)
 {
-  struct frame *evict_frame;
-  struct thread *t = thread_current ();
+  struct owner_search *s = s_;
+  uint32_t *pte;
 
-  lock_acquire (&evict_lock);
+  if (s->owner != NULL || t->pagedir == NULL || t->frames_removed)
+    return;
+  pte = pagedir_get_pte (t->pagedir, s->frame->uvaddr);
+  if (pte != NULL && (*pte & PTE_P) != 0
+      && pte_get_page (*pte) == frame_to_page (s->frame))
+  {
+    s->owner = t;
+    s->pte = pte;
+  }
+}
 
-  evict_frame = select_evictee ();
-  if (evict_frame == NULL)
-    printf ("CAN'T SELECT FRAME TO EVICT");
+/* Hashes text page table entry E by inode and offset */
+static unsigned text_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *frame = hash_entry (e, struct frame, text_elem);
 
-  if (!save_frame (evict_frame))
-    printf ("CAN'T SAVE EVICTED FRAME");
+  return hash_bytes (&frame->inode, sizeof frame->inode)
+         ^ hash_int (frame->file_ofs);
+}
 
-  evict_frame->tid = t->tid;
-  evict_frame->pte = NULL;
-  
+/* Orders text page table entries A and B by inode, offset and
+ * length */
+static bool text_less (const struct hash_elem *a_,
+                       const struct hash_elem *b_, void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, text_elem);
+  const struct frame *b = hash_entry (b_, struct frame, text_elem);
+
+  if (a->inode != b->inode)
+    return (uintptr_t) a->inode < (uintptr_t) b->inode;
+  if (a->file_ofs != b->file_ofs)
+    return a->file_ofs < b->file_ofs;
+  return a->read_bytes < b->read_bytes;
+}
+
+/* Makes T the owner of FRAME, or makes FRAME ownerless if T is
+ * NULL.  frame_lock must be held */
+static void set_owner (struct frame *frame, struct thread *t)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (frame->owner != NULL)
+    list_remove (&frame->owner_elem);
+  frame->owner = t;
+  if (t != NULL)
+    list_push_back (&t->frames, &frame->owner_elem);
+}
+
+/* Evicts a frame and returns it, with one reference, for reuse
+ * by the current thread, or returns NULL if no frame can be
+ * evicted */
+static void *frame_replace_page (void) 
+{
+  struct victim v;
+  bool to_swap;
+  void *page = NULL;
+
+  lock_acquire (&evict_lock);
+  if (detach_victim (&v))
+  {
+    page = frame_to_page (v.frame);
+    if (prepare_save (&v, &to_swap)
+        && (!to_swap || (v.swap_index = mem_to_swap (page)) != SIZE_MAX))
+    {
+      finish_save (&v);
+      memset (page, 0, PGSIZE);
+    }
+    else
+    {
+      restore_victim (&v);
+      page = NULL;
+    }
+    unlock_owner (&v);
+  }
   lock_release (&evict_lock);
-  return evict_frame;
+  return page;
 }
 
-/* Uses the clock algorithm to select a frame to be
- * evicted from the frame list */
-static struct frame *select_evictee (void)
+/* Evicts up to MAX_CNT frames, at most PAGEOUT_BATCH, and frees
+ * them.  The pages that must go to swap are written together,
+ * in order of owner and virtual address, so that adjacent pages
+ * of a process land in adjacent slots, where swap-in readahead
+ * finds them.  Returns the number of frames freed */
+static size_t pageout_batch (size_t max_cnt)
 {
-  struct thread *t;
-  struct list_elem *e;
-  struct frame *current_frame;
+  struct victim victims[PAGEOUT_BATCH];
+  const void *pages[PAGEOUT_BATCH];
+  size_t slots[PAGEOUT_BATCH];
+  size_t swapping[PAGEOUT_BATCH];
+  size_t cnt, swap_cnt, freed_cnt, i;
 
-  bool selected = false;
+  if (max_cnt > PAGEOUT_BATCH)
+    max_cnt = PAGEOUT_BATCH;
 
-  if (hand == NULL)
+  lock_acquire (&evict_lock);
+  for (cnt = 0; cnt < max_cnt; cnt++)
+    if (!detach_victim (&victims[cnt]))
+      break;
+  sort_victims (victims, cnt);
+
+  swap_cnt = 0;
+  for (i = 0; i < cnt; i++)
   {
-    hand = list_head (&frame_list);
-    list_remove (list_next (hand));
-    hand = list_next (hand);
+    bool to_swap;
+
+    if (!prepare_save (&victims[i], &to_swap))
+    {
+      restore_victim (&victims[i]);
+      victims[i].frame = NULL;
+    }
+    else if (to_swap)
+    {
+      swapping[swap_cnt] = i;
+      pages[swap_cnt++] = frame_to_page (victims[i].frame);
+    }
   }
-  uint32_t round = 0;
-  while (!selected)
+
+  if (swap_cnt > 0)
   {
-    e = hand;
-    while (e != list_tail (&frame_list))
+    bool ok = swap_out_batch (pages, swap_cnt, slots);
+
+    for (i = 0; i < swap_cnt; i++)
     {
-      current_frame = list_entry (e, struct frame, frame_elem);
-      t = thread_from_tid (current_frame->tid);
-      bool dirty = pagedir_is_accessed (t->pagedir, current_frame->uvaddr);
-      if (dirty)
+      struct victim *v = &victims[swapping[i]];
+      if (ok)
+        v->swap_index = slots[i];
+      else
       {
-        pagedir_set_accessed (t->pagedir, current_frame->uvaddr, false);
-      } 
-      else 
-        break;
-      e = list_next (e);
+        restore_victim (v);
+        v->frame = NULL;
+      }
     }
-    if (current_frame != NULL)
-      selected = true;
-    hand = list_head (&frame_list);
-    hand = list_next (hand);
   }
-  return current_frame;
+
+  freed_cnt = 0;
+  for (i = 0; i < cnt; i++)
+    if (victims[i].frame != NULL)
+    {
+      finish_save (&victims[i]);
+      frame_free_page (frame_to_page (victims[i].frame));
+      freed_cnt++;
+    }
+  for (i = 0; i < cnt; i++)
+    unlock_owner (&victims[i]);
+  lock_release (&evict_lock);
+  return freed_cnt;
 }
 
-/* Depending on what type of page is held by the
- * frame that is being evicted, some bookkeeping is
- * done to keep track of where in swap the evicted 
- * memory page is going, etc */
-static bool save_frame (struct frame *evict_frame)
+/* Chooses a frame with the current policy and takes it from its
+ * owner into V, locking the owner's page tables.  Returns false
+ * if there is nothing to evict */
+static bool detach_victim (struct victim *v)
 {
-  struct thread *t;
-  struct suppl_pte *spte;
-  
-  t = thread_from_tid (evict_frame->tid);
-  spte = vaddr_to_suppl_pte (evict_frame->uvaddr);
+  struct frame *frame;
 
-  if (spte == NULL)
+  ASSERT (lock_held_by_current_thread (&evict_lock));
+
+  lock_acquire (&frame_lock);
+  while ((frame = policy->select ()) != NULL
+         && !lock_owner (v, frame->owner))
+    continue;
+  if (frame != NULL)
   {
-    spte = calloc (1, sizeof *spte);
-    spte->vaddr = evict_frame->uvaddr;
-    spte->type = SWAP;
-    if (!insert_suppl_pte (&(t->suppl_page_table), spte))
-      return false;
+    evict_cnt++;
+    v->frame = frame;
+    v->owner = frame->owner;
+    v->uvaddr = frame->uvaddr;
+    v->pte = frame->pte;
+    v->spte = NULL;
+    v->swap_index = SIZE_MAX;
+    set_owner (frame, NULL);
+    forget_text_page (frame);
+    frame->uvaddr = NULL;
+    frame->pte = NULL;
+
+    /* Once the page is not present the CPU can't dirty it any
+     * more, so the dirty bit is final. */
+    pagedir_clear_page (v->owner->pagedir, v->uvaddr);
+    v->dirty = (*v->pte & PTE_D) != 0;
   }
+  lock_release (&frame_lock);
+  return frame != NULL;
+}
 
-  size_t swap_index;
+/* Gives the frame in V back to its owner, when it could not be
+ * saved.  pagedir_clear_page() left the rest of the page table
+ * entry alone, so setting the present bit maps the page again
+ * as it was */
+static void restore_victim (struct victim *v)
+{
+  lock_acquire (&frame_lock);
+  set_owner (v->frame, v->owner);
+  v->frame->uvaddr = v->uvaddr;
+  v->frame->pte = v->pte;
+  *v->pte |= PTE_P;
+  lock_release (&frame_lock);
+}
 
-  if (pagedir_is_dirty (t->pagedir, spte->vaddr) && (spte->type == MMF))
-  {
-    write_back_mmf (spte);
-  }
-  else if (pagedir_is_dirty (t->pagedir, spte->vaddr) || (spte->type != FILE))
+/* Sorts the CNT victims in VICTIMS by owner, then by virtual
+ * address.  CNT is small, so insertion sort does */
+static void sort_victims (struct victim *victims, size_t cnt)
+{
+  size_t i, j;
+
+  for (i = 1; i < cnt; i++)
   {
-    swap_index = mem_to_swap (spte->vaddr);
-    if (swap_index == SIZE_MAX)
-      return false;
+    struct victim v = victims[i];
 
-    spte->type |= SWAP;
+    for (j = i; j > 0; j--)
+    {
+      struct victim *prev = &victims[j - 1];
+      if ((uintptr_t) prev->owner < (uintptr_t) v.owner
+          || (prev->owner == v.owner
+              && (uintptr_t) prev->uvaddr < (uintptr_t) v.uvaddr))
+        break;
+      victims[j] = *prev;
+    }
+    victims[j] = v;
   }
+}
+
+/* Returns true if FRAME may be evicted: it is in use, not
+ * shared, and mapped by a known owner whose page tables are not
+ * busy */
+static bool evictable (struct frame *frame)
+{
+  return (frame->ref_cnt == 1 && frame->owner != NULL && frame->pte != NULL
+          && !vm_busy (frame->owner));
+}
 
-  memset (evict_frame->frame, 0, PGSIZE);
+/* Returns true if another thread holds T's vm_lock, and so may
+ * be changing T's page tables: while it does, T's pages are left
+ * alone rather than waited for */
+static bool vm_busy (struct thread *t)
+{
+  struct thread *holder = t->vm_lock.holder;
 
-  spte->swap_index = swap_index;
-  spte->writable = *(evict_frame->pte) & PTE_W;
+  return holder != NULL && holder != thread_current ();
+}
 
-  spte->loaded = false;
+/* Locks the page tables of T, the owner of the frame V is about
+ * to take, unless the current thread holds the lock already.
+ * Returns false, without waiting, if another thread holds it */
+static bool lock_owner (struct victim *v, struct thread *t)
+{
+  v->locked = !lock_held_by_current_thread (&t->vm_lock);
+  return !v->locked || lock_try_acquire (&t->vm_lock);
+}
+
+/* Unlocks the page tables of V's owner, if lock_owner() locked
+ * them for V */
+static void unlock_owner (struct victim *v)
+{
+  if (v->locked)
+    lock_release (&v->owner->vm_lock);
+}
 
-  pagedir_clear_page (t->pagedir, spte->vaddr);
+/* Returns whether the page in FRAME, which must be evictable,
+ * was accessed since the last call, and clears its accessed bit */
+static bool test_and_clear_accessed (struct frame *frame)
+{
+  uint32_t *pd = frame->owner->pagedir;
 
+  scan_cnt++;
+  if (!pagedir_is_accessed (pd, frame->uvaddr))
+    return false;
+  pagedir_set_accessed (pd, frame->uvaddr, false);
   return true;
 }
 
-/* Sets the page table entry and the virtual address of the frame */
-void frame_set_user_page (void *frame, void *upage, uint32_t *pte)
+/* Clock: sweeps the hand around the frame table, giving each
+ * accessed page a second chance */
+static struct frame *clock_select (void)
 {
-  struct frame *temp_frame;
-  temp_frame = get_frame (frame);
-  if (temp_frame != NULL)
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (i = 0; i < 2 * frame_cnt; i++)
   {
-    temp_frame->uvaddr = upage;
-    temp_frame->pte = pte;
+    struct frame *frame = &frames[hand];
+    hand = (hand + 1) % frame_cnt;
+
+    if (evictable (frame) && !test_and_clear_accessed (frame))
+      return frame;
   }
+  return NULL;
 }
 
-/* Gets a frame struct from the frame list by passing in the 
- * starting address of its memory frame */
-static struct frame *get_frame (void *frame)
+/* Two-handed clock: a front hand, a quarter of the table ahead
+ * of the back hand, clears accessed bits, and the back hand
+ * evicts the first page not used again since.  The spread
+ * between the hands, not a full revolution, sets how long a
+ * page has to prove it is in use */
+static struct frame *clock2_select (void)
 {
-  struct frame *ret_frame;
-  struct list_elem *e;
+  size_t spread = frame_cnt / 4 > 0 ? frame_cnt / 4 : 1;
+  size_t i;
 
-  lock_acquire (&frame_lock);
-  e = list_head (&frame_list);
-  while ((e = list_next (e)) != list_tail (&frame_list))
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (i = 0; i < 2 * frame_cnt; i++)
   {
-    ret_frame = list_entry (e, struct frame, frame_elem);
-    if (ret_frame->frame == frame)
-      break;
-    ret_frame = NULL;
+    struct frame *front = &frames[(hand + spread) % frame_cnt];
+    struct frame *back = &frames[hand];
+    hand = (hand + 1) % frame_cnt;
+
+    if (evictable (front))
+      test_and_clear_accessed (front);
+    if (evictable (back) && !test_and_clear_accessed (back))
+      return back;
   }
-  lock_release (&frame_lock);
-  return ret_frame;
+  return NULL;
 }
 
+/* WSClock: a page used within the last WS_TAU ticks is in its
+ * process's working set and stays.  Of the pages outside any
+ * working set, prefers a clean one, which costs no write.
+ * Falls back to a dirty page outside the working sets, then to
+ * the least recently used page, then to plain clock */
+static struct frame *wsclock_select (void)
+{
+  int64_t now = timer_ticks ();
+  struct frame *dirty = NULL;
+  struct frame *oldest = NULL;
+  size_t i;
 
-void frame_remove_thread (struct thread *t)
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (i = 0; i < frame_cnt; i++)
+  {
+    struct frame *frame = &frames[hand];
+    hand = (hand + 1) % frame_cnt;
+
+    if (!evictable (frame))
+      continue;
+    if (test_and_clear_accessed (frame))
+      frame->last_use = now;
+    else if (now - frame->last_use > WS_TAU)
+    {
+      if (!pagedir_is_dirty (frame->owner->pagedir, frame->uvaddr))
+        return frame;
+      if (dirty == NULL)
+        dirty = frame;
+    }
+    else if (oldest == NULL || frame->last_use < oldest->last_use)
+      oldest = frame;
+  }
+
+  if (dirty != NULL)
+    return dirty;
+  if (oldest != NULL)
+    return oldest;
+  return clock_select ();
+}
+
+/* Aging, an approximation of LRU: each page's age byte shifts
+ * right once per AGE_INTERVAL ticks, with its accessed bit
+ * shifted in at the top, and the page with the lowest age goes.
+ * Ages are brought up to date lazily, when a victim is needed.
+ * Several victims chosen within one interval, as in a pageout
+ * batch, only add the accessed bits seen since, without aging
+ * the pages again */
+static struct frame *aging_select (void)
 {
-  lock_acquire (&frame_lock);
-  struct list_elem *e;
-  struct frame *frame;
-  for (e = list_begin (&frame_list); e != list_end (&frame_list);
-       e = list_next (e))
+  int64_t steps = (timer_ticks () - last_aging) / AGE_INTERVAL;
+  int shift = steps < 8 ? steps : 8;
+  struct frame *victim = NULL;
+  size_t victim_idx = 0;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  last_aging += steps * AGE_INTERVAL;
+
+  /* Start from the hand, so that ties go round robin. */
+  for (i = 0; i < frame_cnt; i++)
+  {
+    size_t idx = (hand + i) % frame_cnt;
+    struct frame *frame = &frames[idx];
+
+    if (!evictable (frame))
+      continue;
+    frame->age >>= shift;
+    if (test_and_clear_accessed (frame))
+      frame->age |= 0x80;
+    if (victim == NULL || frame->age < victim->age)
     {
-      frame = list_entry (e, struct frame, frame_elem);
-      
-      if (frame->tid == t->tid) {
-        list_remove (&frame->frame_elem);
-      }
+      victim = frame;
+      victim_idx = idx;
+    }
+  }
 
-      palloc_free_page(frame->uvaddr);
-      free (frame);
+  if (victim != NULL)
+    hand = (victim_idx + 1) % frame_cnt;
+  return victim;
+}
+
+/* First half of evicting V: finds or makes the supplemental
+ * page table entry for the page, and writes the page back to
+ * its file if it is a dirty memory mapped page.  Sets *TO_SWAP
+ * to whether the page must go to swap, which the caller does.
+ * Returns false if memory runs out */
+static bool prepare_save (struct victim *v, bool *to_swap)
+{
+  struct thread *t = v->owner;
+  struct suppl_pte *spte;
+  bool dirty = v->dirty;
+  
+  spte = suppl_pt_lookup (t, v->uvaddr);
+  if (spte == NULL)
+  {
+    spte = suppl_pte_alloc ();
+    if (spte == NULL)
+      return false;
+    /* No type until finish_save() gives it a swap slot. */
+    memset (spte, 0, sizeof *spte);
+    spte->vaddr = v->uvaddr;
+    if (!insert_suppl_pte (&(t->suppl_page_table), spte))
+    {
+      suppl_pte_free (spte);
+      return false;
     }
+  }
+  v->spte = spte;
 
-  lock_release (&frame_lock);
+  *to_swap = false;
+  if (dirty && (spte->type == MMF))
+    write_back_mmf (spte, frame_to_page (v->frame));
+  else if (dirty || (spte->type != FILE))
+    *to_swap = true;
+  return true;
+}
+
+/* Second half of evicting V, once its contents are safe: does
+ * the bookkeeping to find them again */
+static void finish_save (struct victim *v)
+{
+  struct suppl_pte *spte = v->spte;
+
+  if (v->swap_index != SIZE_MAX)
+  {
+    spte->swap_index = v->swap_index;
+    spte->type |= SWAP;
+  }
+  spte->writable = (*v->pte & (PTE_W | PTE_COW)) != 0;
+  spte->loaded = false;
 }
@@ -1,27 +1,48 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
+#include <hash.h>
 #include <list.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 
+struct inode;
+
+/* Frame table entry.  There is one for each page in the user
+   pool, whether in use or not. */
 struct frame 
 {
-  uint32_t *pte;
-  void *uvaddr;
-  void *frame;
-  tid_t tid;
-  struct list_elem frame_elem;
-};
+  int ref_cnt;                  /* Page tables mapping it, 0 if free. */
+  struct thread *owner;         /* Process mapping it, NULL if unknown. */
+  void *uvaddr;                 /* User virtual address in OWNER. */
+  uint32_t *pte;                /* Page table entry in OWNER. */
+  struct list_elem owner_elem;  /* Element in OWNER's frames list. */
+  int64_t last_use;             /* Ticks at last seen use (wsclock). */
+  uint8_t age;                  /* Recent use history (aging). */
 
-struct list frame_list;
-struct lock frame_lock;
-struct lock evict_lock;
+  /* Shared text pages (see frame_get_text_page()). */
+  struct inode *inode;          /* Executable the page came from, or NULL. */
+  off_t file_ofs;               /* Offset of the page in INODE. */
+  uint32_t read_bytes;          /* Bytes read from INODE, the rest zeros. */
+  struct hash_elem text_elem;   /* Element in the text page table. */
+};
 
+bool frame_set_policy (const char *);
 void frame_init (void);
+void frame_start_pageout (size_t low, size_t high);
 void *frame_get_page(enum palloc_flags);
+void *frame_try_get_page (void);
 void frame_free_page (void *);
 void frame_set_user_page (void *, void *, uint32_t *);
 void frame_remove_thread (struct thread *);
+void frame_share (void *);
+void *frame_zero_page (void);
+void *frame_get_text_page (struct inode *, off_t, uint32_t read_bytes);
+void *frame_add_text_page (void *, struct inode *, off_t,
+                           uint32_t read_bytes);
+void *frame_unshare (void *, void *, uint32_t *);
+void frame_print_stats (void);
 
 #endif /* vm/frame.h */
@@ -1,7 +1,8 @@
 #include "vm/page.h"
 #include "lib/kernel/hash.h"
 #include "threads/thread.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
@@ -10,6 +11,151 @@
 #include <stdio.h>
 #include <string.h>
 
+/* Caches of supplemental page table entries and memory mapped
+ * files. */
+static struct slab_cache suppl_pte_cache;
+static struct slab_cache mm_file_cache;
+
+/* Most pages read ahead after a page fault on a swapped out
+ * page. */
+#define SWAP_READAHEAD 4
+
+static void suppl_pte_destroy (struct hash_elem *, void *);
+static void mm_file_discard (struct hash_elem *, void *);
+static bool swap_in (struct thread *, struct suppl_pte *, void *kpage);
+static void swap_readahead (struct thread *, uint8_t *vaddr,
+                            size_t swap_index);
+
+/* Initializes the supplemental page table entry and memory
+ * mapped file allocators. */
+void suppl_pt_init (void)
+{
+  slab_cache_init (&suppl_pte_cache, "suppl_pte", sizeof (struct suppl_pte),
+                   NULL);
+  slab_cache_init (&mm_file_cache, "mm_file", sizeof (struct mm_file), NULL);
+}
+
+/* Allocates a supplemental page table entry.
+   Returns NULL if memory is not available. */
+struct suppl_pte *suppl_pte_alloc (void)
+{
+  return slab_alloc (&suppl_pte_cache);
+}
+
+/* Frees PTE, which must already be out of any page table. */
+void suppl_pte_free (struct suppl_pte *pte)
+{
+  slab_free (&suppl_pte_cache, pte);
+}
+
+/* Allocates a memory mapped file.
+ * Returns NULL if memory is not available. */
+struct mm_file *mm_file_alloc (void)
+{
+  return slab_alloc (&mm_file_cache);
+}
+
+/* Frees memory mapped file MMF, which must already be out of
+ * any thread's mm_files. */
+void mm_file_free (struct mm_file *mmf)
+{
+  slab_free (&mm_file_cache, mmf);
+}
+
+/*
+ * Copies PARENT's memory mapped files and supplemental page table
+ * into CHILD, whose tables must be initialized, for fork.
+ * Pages PARENT has in memory are shared with CHILD by
+ * pagedir_duplicate; the entries copied here also describe pages
+ * that are not loaded yet or are swapped out.  CHILD gets its own
+ * files and its own copy of each swap slot.
+ * Returns false if memory or swap space runs out
+ */
+bool suppl_pt_duplicate (struct thread *child, struct thread *parent)
+{
+  struct hash_iterator i;
+
+  hash_first (&i, &parent->mm_files);
+  while (hash_next (&i))
+  {
+    struct mm_file *mmf = hash_entry (hash_cur (&i), struct mm_file, elem);
+    struct mm_file *copy = mm_file_alloc ();
+    if (copy == NULL)
+      return false;
+    *copy = *mmf;
+    copy->file = file_reopen (mmf->file);
+    if (copy->file == NULL)
+    {
+      mm_file_free (copy);
+      return false;
+    }
+    hash_insert (&child->mm_files, &copy->elem);
+  }
+
+  hash_first (&i, &parent->suppl_page_table);
+  while (hash_next (&i))
+  {
+    struct suppl_pte *pte = hash_entry (hash_cur (&i), struct suppl_pte, elem);
+    struct suppl_pte *copy = suppl_pte_alloc ();
+    if (copy == NULL)
+      return false;
+    *copy = *pte;
+
+    if (pte->type & MMF)
+    {
+      /* Share the child's reopened copy of the mapped file. */
+      struct mm_file key;
+      struct hash_elem *e;
+      key.mm_id = pte->mm_id;
+      e = hash_find (&child->mm_files, &key.elem);
+      copy->file = e != NULL ? hash_entry (e, struct mm_file, elem)->file : NULL;
+    }
+    else if (pte->type & FILE)
+    {
+      copy->file = file_reopen (pte->file);
+      if (copy->file == NULL)
+      {
+        suppl_pte_free (copy);
+        return false;
+      }
+    }
+
+    if (pte->type & SWAP)
+    {
+      copy->swap_index = swap_duplicate (pte->swap_index);
+      if (copy->swap_index == SIZE_MAX)
+      {
+        if (copy->type & FILE)
+          file_close (copy->file);
+        suppl_pte_free (copy);
+        return false;
+      }
+    }
+    hash_insert (&child->suppl_page_table, &copy->elem);
+  }
+  return true;
+}
+
+/* Undoes suppl_pt_duplicate() for CHILD, which never ran because
+ * fork failed, even if suppl_pt_duplicate() stopped part way:
+ * closes the files it reopened and frees CHILD's memory mapped
+ * files, supplemental page table and swap slots */
+void suppl_pt_discard (struct thread *child)
+{
+  struct hash_iterator i;
+
+  hash_first (&i, &child->suppl_page_table);
+  while (hash_next (&i))
+  {
+    struct suppl_pte *pte = hash_entry (hash_cur (&i), struct suppl_pte, elem);
+    if ((pte->type & (FILE | MMF)) == FILE)
+      file_close (pte->file);
+  }
+  suppl_pt_destroy (child);
+
+  hash_destroy (&child->mm_files, mm_file_discard);
+}
+
 /*
  * Looks up a virtural address in the supplemental page table. 
  * Returns the struct suppl_pte for the virtural address
@@ -17,11 +163,19 @@
  */
 struct suppl_pte *vaddr_to_suppl_pte(uint32_t *vaddr)
 {
-  struct hash suppl_page_table = thread_current()->suppl_page_table;
+  return suppl_pt_lookup (thread_current (), vaddr);
+}
+
+/*
+ * Looks up a virtual address in thread T's supplemental page
+ * table.  Returns NULL if it does not exist in the hash table
+ */
+struct suppl_pte *suppl_pt_lookup (struct thread *t, void *vaddr)
+{
   struct suppl_pte pte;
   pte.vaddr = vaddr;
   
-  struct hash_elem *hash_elem = hash_find(&suppl_page_table, &(pte.elem));
+  struct hash_elem *hash_elem = hash_find(&t->suppl_page_table, &(pte.elem));
   
   if(hash_elem != NULL)
   {
@@ -30,8 +184,37 @@ struct suppl_pte *vaddr_to_suppl_pte(uint32_t *vaddr)
   return NULL;
 }
 
+/* Frees the supplemental page table of exiting process T, and
+ * the swap slots of its swapped out pages.  Page replacement must
+ * be done with T's frames, see frame_remove_thread() */
+void suppl_pt_destroy (struct thread *t)
+{
+  hash_destroy (&t->suppl_page_table, suppl_pte_destroy);
+}
+
+/* Frees the supplemental page table entry at E and its swap
+ * slot, if any.  A hash_action_func for suppl_pt_destroy() */
+static void suppl_pte_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct suppl_pte *pte = hash_entry (e, struct suppl_pte, elem);
+
+  if (pte->type & SWAP)
+    swap_free (pte->swap_index);
+  suppl_pte_free (pte);
+}
+
+/* Closes and frees the memory mapped file at E.  A
+ * hash_action_func for suppl_pt_discard() */
+static void mm_file_discard (struct hash_elem *e, void *aux UNUSED)
+{
+  struct mm_file *mmf = hash_entry (e, struct mm_file, elem);
+
+  file_close (mmf->file);
+  mm_file_free (mmf);
+}
+
 /* Load Page */
-bool load_page(struct suppl_pte *pte)
+bool load_page(struct suppl_pte *pte, bool write)
 {
   //find type of file
   enum suppl_pte_type type = pte->type;
@@ -41,7 +224,7 @@ bool load_page(struct suppl_pte *pte)
   }
   else if(type == FILE)
   {
-    return load_page_file(pte);
+    return load_page_file(pte, write);
   }
   else if(type == MMF)
   {
@@ -53,63 +236,144 @@ bool load_page(struct suppl_pte *pte)
 
 bool load_page_swap(struct suppl_pte *spte)
 {
+  struct thread *t = thread_current ();
+  uint8_t *vaddr = spte->vaddr;
+  size_t swap_index = spte->swap_index;
   uint8_t *kpage = frame_get_page (PAL_USER);
 
   if (kpage == NULL)
     return false;
 
-  if (!pagedir_set_page (thread_current ()->pagedir, spte->vaddr, 
-        kpage, spte->writable))
+  if (!swap_in (t, spte, kpage))
   {
     frame_free_page (kpage);
     return false;
   }
+  swap_readahead (t, vaddr, swap_index);
+  return true;
+}
+
+/* Reads the swapped out page SPTE describes into KPAGE and maps
+ * it in T.  The page is read before it is mapped so that page
+ * replacement can't pick it while it is only partly filled, and
+ * its swap slot is released only once it is mapped, so that a
+ * failure leaves it swapped out */
+static bool swap_in (struct thread *t, struct suppl_pte *spte, void *kpage)
+{
+  uint8_t *vaddr = spte->vaddr;
+
+  swap_to_mem (spte->swap_index, kpage);
+  if (!pagedir_set_page (t->pagedir, vaddr, kpage, spte->writable))
+    return false;
+  swap_free (spte->swap_index);
 
-  swap_to_mem (spte->swap_index, spte->vaddr);
   if (spte->type == SWAP)
   {
-    hash_delete (&thread_current()->suppl_page_table, &spte->elem);
-  }
-  if (spte->type == (FILE | SWAP)) 
-  {
-    spte->type = FILE;
-    spte->loaded = true;
+    hash_delete (&t->suppl_page_table, &spte->elem);
+    suppl_pte_free (spte);
+    return true;
   }
 
+  /* The swap slot is gone.  A page that came from an executable
+   * differs from its file, so it must go to swap again if it is
+   * evicted. */
+  if (spte->type == (FILE | SWAP))
+    pagedir_set_dirty (t->pagedir, vaddr, true);
+  spte->type &= ~SWAP;
+  spte->loaded = true;
   return true;
 }
 
-bool load_page_file(struct suppl_pte *pte)
+/*
+ * Swap-in readahead, after T faulted in the page at VADDR from
+ * slot SWAP_INDEX.  Pages evicted together are written to
+ * adjacent swap slots in order of virtual address, so the pages
+ * after VADDR are likely in the slots after SWAP_INDEX.  Brings
+ * in up to SWAP_READAHEAD of them while that holds and free
+ * frames are plentiful.  They are mapped with their accessed
+ * bits clear, so page replacement reclaims them first if they go
+ * unused.
+ */
+static void swap_readahead (struct thread *t, uint8_t *vaddr,
+                            size_t swap_index)
+{
+  int i;
+
+  for (i = 1; i <= SWAP_READAHEAD; i++)
+  {
+    struct suppl_pte *next;
+    void *kpage;
+
+    vaddr += PGSIZE;
+    if (!is_user_vaddr (vaddr))
+      break;
+    next = suppl_pt_lookup (t, vaddr);
+    if (next == NULL || !(next->type & SWAP) || next->loaded
+        || next->swap_index != swap_index + i
+        || pagedir_get_page (t->pagedir, vaddr) != NULL)
+      break;
+
+    kpage = frame_try_get_page ();
+    if (kpage == NULL)
+      break;
+    if (!swap_in (t, next, kpage))
+    {
+      frame_free_page (kpage);
+      break;
+    }
+  }
+}
+
+bool load_page_file(struct suppl_pte *pte, bool write)
 {
 
   struct thread *t = thread_current();
+
+  /* A page of nothing but zeros maps the shared zero page until
+   * it is first written. */
+  if (pte->bytes_read == 0 && !write)
+  {
+    if (pagedir_get_page (t->pagedir, pte->vaddr) != NULL
+        || !pagedir_share_page (t->pagedir, pte->vaddr, frame_zero_page (),
+                                pte->writable))
+      return false;
+    pte->loaded = true;
+    return true;
+  }
  
-  file_seek(pte->file, pte->file_offset); 
+  /* Read-only pages of an executable are shared by every process
+   * running it. */
+  struct inode *inode = file_get_inode (pte->file);
+  uint8_t *kpage = NULL;
+  if (!pte->writable)
+    kpage = frame_get_text_page (inode, pte->file_offset, pte->bytes_read);
 
-  uint32_t bytes_read = pte->bytes_read;
-  uint32_t bytes_zero = pte->bytes_zero;
-  
-  //load the page with info from suppl_pte
-  
-  //get page of memory
-  uint8_t *kpage = frame_get_page (PAL_USER); 
-  if(kpage == NULL)
+  if (kpage == NULL)
   {
-    return false;
-  }  
-  
-  //load page
-  off_t b_read = file_read(pte->file, kpage, pte->bytes_read);
-  off_t expected_b_read = pte->bytes_read;
-  off_t of = file_tell(pte->file);
-  struct file *f = pte->file;
-  
-  if(b_read != expected_b_read)
-  { 
-    frame_free_page(kpage);
-    return false;
+    file_seek(pte->file, pte->file_offset); 
+
+    //get page of memory
+    kpage = frame_get_page (PAL_USER); 
+    if(kpage == NULL)
+    {
+      return false;
+    }  
+
+    //load page
+    off_t b_read = file_read(pte->file, kpage, pte->bytes_read);
+    off_t expected_b_read = pte->bytes_read;
+
+    if(b_read != expected_b_read)
+    { 
+      frame_free_page(kpage);
+      return false;
+    }
+    memset(kpage + pte->bytes_read, 0, pte->bytes_zero);
+
+    if (!pte->writable)
+      kpage = frame_add_text_page (kpage, inode, pte->file_offset,
+                                   pte->bytes_read);
   }
-  memset(kpage + pte->bytes_read, 0, pte->bytes_zero);
 
   bool install_page = (pagedir_get_page(t->pagedir, pte->vaddr) == NULL)
 		&& (pagedir_set_page (t->pagedir, pte->vaddr, kpage, pte->writable));
@@ -124,12 +388,12 @@ bool load_page_file(struct suppl_pte *pte)
   return true;
 }
 
-void write_back_mmf (struct suppl_pte *spte)
+void write_back_mmf (struct suppl_pte *spte, void *kpage)
 {
   if (spte->type == MMF)
   {
     file_seek (spte->file, spte->file_offset);
-    file_write (spte->file, spte->vaddr, spte->bytes_read);
+    file_write (spte->file, kpage, spte->bytes_read);
   }
 }
 
@@ -192,7 +456,7 @@ bool insert_suppl_pte(struct hash *pt, struct suppl_pte *pte)
  */ 
 bool suppl_pt_insert_file(uint8_t *vaddr, struct file *file, off_t offset, uint32_t bytes_read, uint32_t bytes_zero, bool writable)
 {
-  struct suppl_pte *pte  = malloc(sizeof (struct suppl_pte));
+  struct suppl_pte *pte  = suppl_pte_alloc ();
   if(pte == NULL)
   {
     return false;
@@ -220,7 +484,7 @@ bool suppl_pt_insert_file(uint8_t *vaddr, struct file *file, off_t offset, uint3
 
 bool suppl_pt_insert_mmf(struct file *f, off_t offset, uint8_t *upage, uint32_t read_bytes, uint32_t zero_bytes, int id)
 {
-  struct suppl_pte *pte  = malloc(sizeof (struct suppl_pte));
+  struct suppl_pte *pte  = suppl_pte_alloc ();
   if(pte == NULL)
   {
     return false;
@@ -236,6 +500,7 @@ bool suppl_pt_insert_mmf(struct file *f, off_t offset, uint8_t *upage, uint32_t
   pte->loaded = false;
   pte->writable = true; 
   pte->type = MMF;
+  pte->mm_id = id;
 
   //add page to thread_current()'s suppl hash table
   struct thread *t = thread_current();
@@ -6,6 +6,8 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+struct thread;
+
 
 enum suppl_pte_type{
   SWAP = 001,
@@ -42,11 +44,20 @@ struct suppl_pte{
   int pg_count;
 };
 
-bool load_page(struct suppl_pte *pte);
+void suppl_pt_init (void);
+struct suppl_pte *suppl_pte_alloc (void);
+void suppl_pte_free (struct suppl_pte *);
+struct mm_file *mm_file_alloc (void);
+void mm_file_free (struct mm_file *);
+bool suppl_pt_duplicate (struct thread *child, struct thread *parent);
+void suppl_pt_destroy (struct thread *);
+void suppl_pt_discard (struct thread *child);
+bool load_page(struct suppl_pte *pte, bool write);
 bool load_page_swap(struct suppl_pte *pte);
-bool load_page_file(struct suppl_pte *pte);
+bool load_page_file(struct suppl_pte *pte, bool write);
 bool load_page_mmf(struct suppl_pte *pte);
 struct suppl_pte *vaddr_to_suppl_pte(uint32_t *vaddr);
+struct suppl_pte *suppl_pt_lookup (struct thread *, void *vaddr);
 bool insert_suppl_pte(struct hash *, struct suppl_pte *pte);
 bool suppl_pt_insert_file(uint8_t *vaddr, struct file *file, off_t offset, uint32_t bytes_read, uint32_t bytes_zero, bool writable);
 bool suppl_pt_insert_mmf(struct file *f, off_t offset, uint8_t *upage, uint32_t read_bytes, uint32_t zero_bytes, int id);
@@ -54,6 +65,6 @@ unsigned page_hash (const struct hash_elem *p_, void *aux);
 bool page_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux);
 unsigned mmf_hash(const struct hash_elem *p_, void *aux);
 bool mmf_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux);
-void write_back_mmf (struct suppl_pte *);
+void write_back_mmf (struct suppl_pte *, void *kpage);
 
 #endif /* vm/page.h */
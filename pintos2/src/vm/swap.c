@@ -1,7 +1,15 @@
 #include "devices/block.h"
+#include "devices/timer.h"
 #include "lib/kernel/bitmap.h"
+#include "lib/kernel/lz.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
+#include <debug.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "vm/swap.h"
 
 #define BLOCK_SECTORS_PER_PAGE ((size_t) (PGSIZE) / (BLOCK_SECTOR_SIZE))
@@ -9,7 +17,60 @@
 static struct bitmap *swap_map;
 struct block *swap_device;
 
+/* Compressed swap cache.  Pages are compressed into memory on
+ * their way to swap, and go to the swap device only once the
+ * cache's budget is spent or if they don't compress well.  Its
+ * slots are numbered after the swap device's, so that swap
+ * indexes cover both. */
+struct zslot
+{
+  void *data;                   /* Compressed page, NULL if free. */
+  size_t size;                  /* Bytes at DATA. */
+};
+
+/* Default budget, in pages, set by -zswap. */
+#define ZCACHE_DEFAULT_PAGES 64
+
+/* Largest compressed page kept in the cache.  Larger blocks
+ * would cost malloc() a whole page anyway. */
+#define ZCACHE_MAX_SIZE (PGSIZE / 4)
+
+static size_t zcache_budget = ZCACHE_DEFAULT_PAGES * PGSIZE; /* In bytes. */
+static size_t zcache_used;      /* Bytes of compressed data held. */
+static struct zslot *zslots;
+static struct bitmap *zslot_map;
+static size_t disk_slot_cnt;    /* Slots on the swap device. */
+
+/* Scratch space for the compressor. */
+static uint8_t zbuf[ZCACHE_MAX_SIZE];
+static uint8_t lz_work[LZ_WORK_SIZE];
+
+/* Protects swap_map and the compressed swap cache. */
+static struct lock swap_lock;
+
+/* Sector just past the last one transferred, to count seeks. */
+static block_sector_t next_sector;
+
+/* Statistics. */
+static long long swap_read_cnt;         /* Pages read from swap. */
+static long long swap_write_cnt;        /* Pages written to swap. */
+static long long swap_seek_cnt;         /* Transfers not contiguous
+                                           with the previous one. */
+static int64_t swap_ticks;              /* Ticks spent in swap I/O. */
+static long long zcache_store_cnt;      /* Pages compressed into the cache. */
+static long long zcache_reject_cnt;     /* Pages that compressed badly. */
+static long long zcache_spill_cnt;      /* Pages sent past a full cache. */
+static long long zcache_hit_cnt;        /* Swap-ins from the cache. */
+static long long zcache_miss_cnt;       /* Swap-ins from the device. */
+static long long zcache_bytes;          /* Total size of pages stored. */
+
 static block_sector_t num_pages_in_swap (void);
+static void read_slot (size_t, void *);
+static void write_slot (size_t, const void *);
+static void note_transfer (size_t);
+static size_t zcache_store (const void *);
+static bool zcache_load (size_t, void *);
+static size_t alloc_disk_slot (void);
 
 /* Initializes the swap map and the swap device so
  * we can access the swap disk */
@@ -20,32 +81,199 @@ void init_swap_table (void)
   swap_map = bitmap_create (num_pages_in_swap ());
 
   bitmap_set_all (swap_map, false);
+  disk_slot_cnt = bitmap_size (swap_map);
+  lock_init (&swap_lock);
+
+  if (zcache_budget > 0)
+  {
+    /* Even a page of zeros takes a few dozen bytes. */
+    size_t zslot_cnt = zcache_budget / 32;
+
+    zslots = calloc (zslot_cnt, sizeof *zslots);
+    zslot_map = bitmap_create (zslot_cnt);
+    if (zslots == NULL || zslot_map == NULL)
+      PANIC ("can't allocate compressed swap cache");
+  }
+}
+
+/* Sets the compressed swap cache's budget to PAGES pages of
+ * memory, or turns the cache off if PAGES is 0.  Call before
+ * init_swap_table() */
+void swap_set_cache_size (size_t pages)
+{
+  zcache_budget = pages * PGSIZE;
 }
 
 /* Copies a page from memory onto the swap disk */
 size_t mem_to_swap (const void *addr)
 {
-  size_t swap_index = bitmap_scan_and_flip (swap_map, 0, 1, false);
+  size_t swap_index;
+
+  if (!swap_out_batch (&addr, 1, &swap_index))
+    return SIZE_MAX;
+  return swap_index;
+}
+
+/* Writes the CNT pages in PAGES to swap in one pass, in adjacent
+ * slots if there is a long enough run of free ones, and stores
+ * the slot of each page in the corresponding element of SLOTS.
+ * Returns false, writing nothing, if the swap disk is too full */
+bool swap_out_batch (const void *pages[], size_t cnt, size_t slots[])
+{
+  size_t disk_cnt = 0;
+  size_t first;
+  size_t i, j;
+
+  for (i = 0; i < cnt; i++)
+  {
+    slots[i] = zcache_store (pages[i]);
+    if (slots[i] == SIZE_MAX)
+      disk_cnt++;
+  }
+  if (disk_cnt == 0)
+    return true;
+
+  lock_acquire (&swap_lock);
+  first = bitmap_scan_and_flip_next (swap_map, disk_cnt, false);
+  for (i = j = 0; i < cnt; i++)
+  {
+    if (slots[i] != SIZE_MAX)
+      continue;
+    if (first != BITMAP_ERROR)
+      slots[i] = first + j++;
+    else
+    {
+      /* No run long enough: take whatever slots are free. */
+      slots[i] = alloc_disk_slot ();
+      if (slots[i] == SIZE_MAX)
+      {
+        lock_release (&swap_lock);
+        for (j = 0; j < cnt; j++)
+          if (slots[j] != SIZE_MAX)
+            swap_free (slots[j]);
+        return false;
+      }
+    }
+  }
+  lock_release (&swap_lock);
+
+  for (i = 0; i < cnt; i++)
+    if (slots[i] < disk_slot_cnt)
+      write_slot (slots[i], pages[i]);
+  swap_write_cnt += disk_cnt;
+  return true;
+}
+
+/* Copies the page in swap slot SWAP_INDEX into memory at ADDR.
+ * The slot keeps the page: release it with swap_free() once the
+ * copy is safely mapped */
+void swap_to_mem (size_t swap_index, void *addr)
+{
+  if (zcache_load (swap_index, addr))
+    return;
+
+  read_slot (swap_index, addr);
+
+  lock_acquire (&swap_lock);
+  zcache_miss_cnt++;
+  lock_release (&swap_lock);
+  swap_read_cnt++;
+}
+
+/* Releases swap slot SWAP_INDEX, whose page is no longer
+ * needed */
+void swap_free (size_t swap_index)
+{
+  lock_acquire (&swap_lock);
+  if (swap_index < disk_slot_cnt)
+    bitmap_reset (swap_map, swap_index);
+  else
+  {
+    struct zslot *z = &zslots[swap_index - disk_slot_cnt];
+
+    zcache_used -= z->size;
+    free (z->data);
+    z->data = NULL;
+    bitmap_reset (zslot_map, swap_index - disk_slot_cnt);
+  }
+  lock_release (&swap_lock);
+}
+
+/* Copies the page in swap slot SWAP_INDEX to a free slot, for a
+ * forked child, and returns the new slot, or SIZE_MAX if the
+ * swap disk is full */
+size_t swap_duplicate (size_t swap_index)
+{
+  uint8_t buffer[BLOCK_SECTOR_SIZE];
+  size_t copy_index;
+
+  if (swap_index >= disk_slot_cnt)
+  {
+    /* Copy a compressed page by way of a temporary page. */
+    struct zslot *z = &zslots[swap_index - disk_slot_cnt];
+    void *page = palloc_get_page (0);
 
-  if (swap_index == BITMAP_ERROR)
+    if (page == NULL)
+      return SIZE_MAX;
+    lock_acquire (&swap_lock);
+    if (!lz_decompress (z->data, z->size, page, PGSIZE))
+      PANIC ("corrupt compressed swap slot %zu", swap_index);
+    lock_release (&swap_lock);
+    copy_index = mem_to_swap (page);
+    palloc_free_page (page);
+    return copy_index;
+  }
+
+  lock_acquire (&swap_lock);
+  copy_index = alloc_disk_slot ();
+  lock_release (&swap_lock);
+  if (copy_index == SIZE_MAX)
     return SIZE_MAX;
 
   size_t current_block_sector = 0;
   while (current_block_sector < BLOCK_SECTORS_PER_PAGE)
   {
+    block_read (swap_device, current_block_sector
+        + swap_index * BLOCK_SECTORS_PER_PAGE, buffer);
     block_write (swap_device, current_block_sector
-        + swap_index * BLOCK_SECTORS_PER_PAGE, 
-        addr + current_block_sector * BLOCK_SECTOR_SIZE);
+        + copy_index * BLOCK_SECTORS_PER_PAGE, buffer);
     current_block_sector++;
   }
 
-  return swap_index;
+  return copy_index;
 }
 
-/* Copied a page from the swap disk into memory */
-void swap_to_mem (size_t swap_index, void *addr)
+/* Prints swap statistics */
+void swap_print_stats (void)
+{
+  printf ("Swap: %lld pages read, %lld pages written, %lld seeks, "
+          "%lld ticks\n",
+          swap_read_cnt, swap_write_cnt, swap_seek_cnt, swap_ticks);
+  if (zslot_map != NULL)
+  {
+    long long ratio = zcache_bytes > 0
+                      ? zcache_store_cnt * PGSIZE * 10 / zcache_bytes : 0;
+    printf ("Swap cache: %lld pages stored, compressed %lld.%lld:1, "
+            "%lld incompressible, %lld spilled; %lld hits, %lld misses\n",
+            zcache_store_cnt, ratio / 10, ratio % 10, zcache_reject_cnt,
+            zcache_spill_cnt, zcache_hit_cnt, zcache_miss_cnt);
+  }
+}
+
+/* Calculates the number of pages that the swap
+ * disk can hold */
+static block_sector_t num_pages_in_swap (void)
+{
+  return block_size (swap_device) / BLOCK_SECTORS_PER_PAGE;
+}
+
+/* Reads the page in swap slot SWAP_INDEX into ADDR */
+static void read_slot (size_t swap_index, void *addr)
 {
+  int64_t start = timer_ticks ();
   size_t current_block_sector = 0;
+
+  note_transfer (swap_index);
   while (current_block_sector < BLOCK_SECTORS_PER_PAGE)
   {
     block_read (swap_device, current_block_sector
@@ -53,13 +281,111 @@ void swap_to_mem (size_t swap_index, void *addr)
         addr + current_block_sector * BLOCK_SECTOR_SIZE);
     current_block_sector++;
   }
+  swap_ticks += timer_elapsed (start);
+}
 
-  bitmap_flip (swap_map, swap_index);
+/* Writes the page at ADDR into swap slot SWAP_INDEX */
+static void write_slot (size_t swap_index, const void *addr)
+{
+  int64_t start = timer_ticks ();
+  size_t current_block_sector = 0;
+
+  note_transfer (swap_index);
+  while (current_block_sector < BLOCK_SECTORS_PER_PAGE)
+  {
+    block_write (swap_device, current_block_sector
+        + swap_index * BLOCK_SECTORS_PER_PAGE, 
+        addr + current_block_sector * BLOCK_SECTOR_SIZE);
+    current_block_sector++;
+  }
+  swap_ticks += timer_elapsed (start);
 }
 
-/* Calculates the number of pages that the swap
- * disk can hold */
-static block_sector_t num_pages_in_swap (void)
+/* Counts a seek if swap slot SWAP_INDEX does not start where the
+ * previous transfer ended */
+static void note_transfer (size_t swap_index)
 {
-  return block_size (swap_device) / BLOCK_SECTORS_PER_PAGE;
+  block_sector_t sector = swap_index * BLOCK_SECTORS_PER_PAGE;
+
+  if (sector != next_sector)
+    swap_seek_cnt++;
+  next_sector = sector + BLOCK_SECTORS_PER_PAGE;
+}
+
+/* Compresses PAGE into the compressed swap cache and returns its
+ * swap index, or returns SIZE_MAX if the page must go to the
+ * swap device instead */
+static size_t zcache_store (const void *page)
+{
+  size_t size, z;
+  void *data;
+
+  if (zslot_map == NULL)
+    return SIZE_MAX;
+
+  lock_acquire (&swap_lock);
+  size = lz_compress (page, PGSIZE, zbuf, sizeof zbuf, lz_work);
+  if (size == 0)
+  {
+    zcache_reject_cnt++;
+    goto spill;
+  }
+  if (zcache_used + size > zcache_budget)
+    goto full;
+  z = bitmap_scan_and_flip_next (zslot_map, 1, false);
+  if (z == BITMAP_ERROR)
+    goto full;
+  data = malloc (size);
+  if (data == NULL)
+  {
+    bitmap_reset (zslot_map, z);
+    goto full;
+  }
+
+  memcpy (data, zbuf, size);
+  zslots[z].data = data;
+  zslots[z].size = size;
+  zcache_used += size;
+  zcache_bytes += size;
+  zcache_store_cnt++;
+  lock_release (&swap_lock);
+  return disk_slot_cnt + z;
+
+ full:
+  zcache_spill_cnt++;
+ spill:
+  lock_release (&swap_lock);
+  return SIZE_MAX;
+}
+
+/* If SWAP_INDEX is a compressed swap cache slot, decompresses its
+ * page into ADDR and returns true.  Otherwise returns false */
+static bool zcache_load (size_t swap_index, void *addr)
+{
+  struct zslot *z;
+
+  if (swap_index < disk_slot_cnt)
+    return false;
+
+  lock_acquire (&swap_lock);
+  z = &zslots[swap_index - disk_slot_cnt];
+  ASSERT (z->data != NULL);
+  if (!lz_decompress (z->data, z->size, addr, PGSIZE))
+    PANIC ("corrupt compressed swap slot %zu", swap_index);
+  zcache_hit_cnt++;
+  lock_release (&swap_lock);
+  return true;
+}
+
+/* Takes a free slot on the swap device, next-fit, and returns
+ * it, or returns SIZE_MAX if the device is full.  swap_lock must
+ * be held */
+static size_t alloc_disk_slot (void)
+{
+  size_t slot;
+
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  slot = bitmap_scan_and_flip_next (swap_map, 1, false);
+  return slot != BITMAP_ERROR ? slot : SIZE_MAX;
 }
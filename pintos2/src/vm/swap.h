@@ -1,8 +1,16 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 void init_swap_table (void);
+void swap_set_cache_size (size_t pages);
 size_t mem_to_swap (const void *);
+bool swap_out_batch (const void *[], size_t, size_t []);
 void swap_to_mem (size_t, void *);
+void swap_free (size_t);
+size_t swap_duplicate (size_t);
+void swap_print_stats (void);
 
 #endif